@@ -1,17 +1,30 @@
 #include "config.h"
 #include "Arcs.h"
 #include "Arcs/DistanceEst.h"
+#include "Common/BamReader.h"
 #include "Common/ContigProperties.h"
 #include "Common/Estimate.h"
+#include "Common/MappedFile.h"
+#include "Common/MinHash.h"
+#include "Common/OutputBuffer.h"
 #include "Common/SAM.h"
+#include "Common/StatUtil.h"
 #include "Common/StringUtil.h"
 #include "Graph/ContigGraph.h"
 #include "Graph/DirectedGraph.h"
 #include "Graph/DotIO.h"
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <string>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <utility>
+#if _OPENMP
+# include <omp.h>
+#endif
 
 #define PROGRAM "arcs"
 
@@ -35,7 +48,8 @@ PROGRAM " " PACKAGE_VERSION "\n"
 "Paired reads must occur consecutively (interleaved) in the SAM/BAM file.\n"
 "The output of the aligner may either not be sorted,\n"
 "or may be sorted by read name using samtools sort -n.\n"
-"The SAM/BAM file must not be sorted by coordinate position.\n"
+"The SAM/BAM file must not be sorted by coordinate position,\n"
+"unless the --unsorted option is given.\n"
 "\n"
 "The barcode may be found in either the BX:Z:BARCODE SAM tag,\n"
 "or in the read (query) name following an underscore, READNAME_BARCODE.\n"
@@ -49,7 +63,10 @@ PROGRAM " " PACKAGE_VERSION "\n"
 "   -f, --file=FILE       FASTA file of contig sequences to scaffold [optional]\n"
 "   -a, --fofName=FILE    text file listing input SAM/BAM filenames\n"
 "   -s, --seq_id=N        min sequence identity for read alignments [98]\n"
-"   -c, --min_reads=N     min aligned read pairs per barcode mapping [5]\n"
+"   -t, --threads=N       number of threads [1]\n"
+"   -c, --min_reads=N     min aligned read pairs per barcode mapping [5].\n"
+"                         A mapping has at least one read pair, so\n"
+"                         -c 0 is the same as -c 1.\n"
 "   -l, --min_links=N     min shared barcodes between contigs [0]\n"
 "   -z, --min_size=N      min contig length [500]\n"
 "   -b, --base_name=STR   output file prefix\n"
@@ -63,6 +80,31 @@ PROGRAM " " PACKAGE_VERSION "\n"
 "   -r, --error_percent=N p-value for head/tail assignment and link orientation\n"
 "                         (lower is more stringent) [0.05]\n"
 "   -v, --run_verbose     verbose logging\n"
+"       --pair_hash       count links by enumerating the contig pairs\n"
+"                         of each barcode into hash tables [default]\n"
+"       --pair_spgemm     count links by sparse matrix multiplication\n"
+"       --pair_minhash    count links of the candidate contig pairs found\n"
+"                         by MinHash sketches of the contig ends, which\n"
+"                         may miss pairs. With -v, report the recall.\n"
+"       --sketch_size=N   number of MinHash values per contig end [64]\n"
+"       --sketch_bands=N  number of LSH bands, which divides N [32].\n"
+"                         More bands find more pairs of contig ends\n"
+"                         that share few barcodes, but take longer.\n"
+"       --barcode-sorted  the alignments are grouped by barcode, and by\n"
+"                         read name within a barcode (samtools sort -n -t BX).\n"
+"                         Pair the contigs of each barcode as it is read,\n"
+"                         using memory that does not grow with the number\n"
+"                         of barcodes. Requires one alignments file.\n"
+"       --unsorted        the alignments may be in any order, such as sorted\n"
+"                         by coordinate. Pair mates by read name, ignoring\n"
+"                         secondary and supplementary alignments.\n"
+"       --mate_buffer=N   with --unsorted, spill the reads awaiting their\n"
+"                         mates to temporary files in $TMPDIR when more\n"
+"                         than N reads per file are in memory [1000000]\n"
+"       --prefilter       count the reads of each barcode in a first pass\n"
+"                         over the alignments, and store the alignments of\n"
+"                         only the barcodes in the -m range. Requires\n"
+"                         regular files, which are read twice.\n"
 "\n"
 " Distance Estimation Options:\n"
 "\n"
@@ -74,7 +116,7 @@ PROGRAM " " PACKAGE_VERSION "\n"
 "       --dist_tsv=FILE     write min/max distance estimates to FILE\n"
 "       --samples_tsv=FILE  write intra-contig distance/barcode samples to FILE\n";
 
-static const char shortopts[] = "f:a:B:s:c:Dl:z:b:g:m:d:e:r:v";
+static const char shortopts[] = "f:a:B:s:t:c:Dl:z:b:g:m:d:e:r:v";
 
 enum {
     OPT_HELP = 1,
@@ -87,7 +129,16 @@ enum {
     OPT_DIST_TSV,
     OPT_NO_DIST_EST,
     OPT_DIST_MEDIAN,
-    OPT_DIST_UPPER
+    OPT_DIST_UPPER,
+    OPT_PAIR_HASH,
+    OPT_PAIR_SPGEMM,
+    OPT_PAIR_MINHASH,
+    OPT_SKETCH_SIZE,
+    OPT_SKETCH_BANDS,
+    OPT_BARCODE_SORTED,
+    OPT_UNSORTED,
+    OPT_MATE_BUFFER,
+    OPT_PREFILTER
 };
 
 static const struct option longopts[] = {
@@ -98,12 +149,22 @@ static const struct option longopts[] = {
     {"samples_tsv", required_argument, NULL, OPT_SAMPLES_TSV},
     {"dist_tsv", required_argument, NULL, OPT_DIST_TSV},
     {"seq_id", required_argument, NULL, 's'},
+    {"threads", required_argument, NULL, 't'},
     {"min_reads", required_argument, NULL, 'c'},
     {"min_reads", required_argument, NULL, 'c'},
     {"dist_est", no_argument, NULL, 'D'},
     {"no_dist_est", no_argument, NULL, OPT_NO_DIST_EST},
     {"dist_median", no_argument, NULL, OPT_DIST_MEDIAN},
     {"dist_upper", no_argument, NULL, OPT_DIST_UPPER},
+    {"pair_hash", no_argument, NULL, OPT_PAIR_HASH},
+    {"pair_spgemm", no_argument, NULL, OPT_PAIR_SPGEMM},
+    {"pair_minhash", no_argument, NULL, OPT_PAIR_MINHASH},
+    {"sketch_size", required_argument, NULL, OPT_SKETCH_SIZE},
+    {"sketch_bands", required_argument, NULL, OPT_SKETCH_BANDS},
+    {"barcode-sorted", no_argument, NULL, OPT_BARCODE_SORTED},
+    {"unsorted", no_argument, NULL, OPT_UNSORTED},
+    {"mate_buffer", required_argument, NULL, OPT_MATE_BUFFER},
+    {"prefilter", no_argument, NULL, OPT_PREFILTER},
     {"min_links", required_argument, NULL, 'l'},
     {"min_size", required_argument, NULL, 'z'},
     {"base_name", required_argument, NULL, 'b'},
@@ -140,366 +201,1773 @@ typedef ContigGraph<DirectedGraph<Length, DistanceEst>> DistGraph;
 Dictionary g_contigNames;
 unsigned g_nextContigName;
 
+/** Check if SAM flag is one of the accepted ones. */
+static inline bool checkFlag(int flag)
+{
+    flag &= ~0xc0; // clear READ1,READ2
+    return flag == 19 // PAIRED,PROPER_PAIR,REVERSE
+        || flag == 35; // PAIRED,PROPER_PAIR,MREVERSE
+}
+
+/*
+ * Calculate the sequence identity from the number of aligned
+ * query bases, the edit distance, and the sequence length.
+ */
+static inline double calcSequenceIdentity(int qalen, int edit_dist, size_t seqLength) {
+    double si = 0;
+    if (qalen != 0) {
+        double mins = qalen - edit_dist;
+        double div = mins/seqLength;
+        si = div * 100;
+    }
+
+    return si;
+}
+
+
+/* Get all scaffold sizes from FASTA file */
+void getScaffSizes(std::string file, ARCS::ContigToLength& contigLengths) {
+
+    int counter = 0;
+    FastaReader in(file.c_str(), FastaReader::FOLD_CASE);
+    for (FastaRecord rec; in >> rec;) {
+        counter++;
+        int size = rec.seq.length();
+        g_contigNames.insert(rec.id);
+        contigLengths.push_back(size);
+    }
+
+    if (params.verbose)
+        std::cout << "Saw " << counter << " sequences.\n";
+}
+
+/** An alignment record, reduced to the fields used to pair reads. */
+struct Alignment {
+    std::string readName;
+    /** the reference name of a SAM record */
+    std::string scafName;
+    /** the index of the contig in g_contigNames, or -1 if none */
+    int contig;
+    BarcodeKey index;
+    int flag;
+    int pos;
+    /** the reference name, contig and position of the mate */
+    std::string mateName;
+    int mateContig;
+    int matePos;
+    int mapq;
+    int si;
+    bool hasSeq;
+};
+
+/** The unpaired reads of an alignments file. */
+struct UnpairedReads {
+    /** Number of unpaired reads. */
+    size_t count;
+
+    /** The first unpaired read and the read that follows it. */
+    std::string prevRN, currRN;
+
+    UnpairedReads() : count(0) { }
+};
+
+/** The fields of an alignment used to pair it with its mate. */
+struct Mate {
+    BarcodeKey index;
+    int contig, flag, pos, mapq, si;
+    bool hasSeq;
+};
+
+/*
+ * Find the mates of reads that are in any order, by read name. A read
+ * waits in a hash table until its mate is read. When the table holds
+ * more than capacity reads, they are spilled to temporary files,
+ * partitioned by read name, whose reads are paired at the end.
+ */
+struct MateBuffer {
+    typedef std::unordered_map<std::string, Mate> Map;
+
+    /** The number of temporary files of spilled reads */
+    static const unsigned NUM_SPILL_FILES = 16;
+
+    size_t capacity;
+    Map mates;
+    std::vector<FILE*> files;
+
+    MateBuffer() : capacity(params.mate_buffer) {}
+    MateBuffer(const MateBuffer&) = delete;
+    MateBuffer& operator=(const MateBuffer&) = delete;
+
+    ~MateBuffer()
+    {
+        for (FILE* file : files)
+            fclose(file);
+    }
+
+    /*
+     * Find the mate of a read and remove it from the buffer, or else
+     * add the read. Return whether the mate was found.
+     */
+    bool findMate(const std::string& name, const Mate& read, Mate& mate)
+    {
+        auto inserted = mates.insert(Map::value_type(name, read));
+        if (inserted.second) {
+            if (mates.size() > capacity)
+                spill();
+            return false;
+        }
+        mate = inserted.first->second;
+        mates.erase(inserted.first);
+        return true;
+    }
+
+    /*
+     * Pair the reads that are left in the buffer or were spilled,
+     * calling f(mate, read) for each pair, and count the reads whose
+     * mate was not found.
+     */
+    template <typename F>
+    void pairSpilled(F f, UnpairedReads& unpaired)
+    {
+        if (files.empty()) {
+            addUnpaired(mates, unpaired);
+            Map().swap(mates);
+            return;
+        }
+        spill();
+        std::string name;
+        Mate read;
+        for (FILE* file : files) {
+            rewind(file);
+            Map bucket;
+            while (readSpilled(file, name, read)) {
+                auto inserted = bucket.insert(Map::value_type(name, read));
+                if (!inserted.second) {
+                    f(inserted.first->second, read);
+                    bucket.erase(inserted.first);
+                }
+            }
+            addUnpaired(bucket, unpaired);
+            fclose(file);
+        }
+        files.clear();
+    }
+
+  private:
+    /** Write the reads in memory to the temporary files. */
+    void spill()
+    {
+        if (files.empty())
+            for (unsigned i = 0; i < NUM_SPILL_FILES; ++i)
+                files.push_back(createTempFile());
+        std::hash<std::string> hash;
+        for (const auto& x : mates) {
+            FILE* file = files[hash(x.first) % files.size()];
+            uint32_t size = x.first.size();
+            if (fwrite(&size, sizeof size, 1, file) != 1
+                    || fwrite(x.first.data(), 1, size, file) != size
+                    || fwrite(&x.second, sizeof x.second, 1, file) != 1) {
+                std::cerr << PROGRAM ": error: writing a temporary file: "
+                    << strerror(errno) << '\n';
+                exit(EXIT_FAILURE);
+            }
+        }
+        Map().swap(mates);
+    }
+
+    /** Read a spilled read. Return false at the end of the file. */
+    static bool readSpilled(FILE* file, std::string& name, Mate& read)
+    {
+        uint32_t size;
+        if (fread(&size, sizeof size, 1, file) != 1)
+            return false;
+        name.resize(size);
+        if (fread(&name[0], 1, size, file) != size
+                || fread(&read, sizeof read, 1, file) != 1) {
+            std::cerr << PROGRAM ": error: reading a temporary file\n";
+            exit(EXIT_FAILURE);
+        }
+        return true;
+    }
+
+    /** Create a temporary file in $TMPDIR, which is removed when closed. */
+    static FILE* createTempFile()
+    {
+        const char* dir = getenv("TMPDIR");
+        std::string path = std::string(dir != NULL && *dir != '\0' ? dir : "/tmp")
+            + "/" PROGRAM ".XXXXXX";
+        int fd = mkstemp(&path[0]);
+        FILE* file = fd >= 0 ? fdopen(fd, "w+b") : NULL;
+        if (file == NULL) {
+            std::cerr << PROGRAM ": error: creating a temporary file: "
+                << path << ": " << strerror(errno) << '\n';
+            exit(EXIT_FAILURE);
+        }
+        unlink(path.c_str());
+        return file;
+    }
+
+    /** Count the reads of a map as unpaired. */
+    static void addUnpaired(const Map& m, UnpairedReads& unpaired)
+    {
+        if (m.empty())
+            return;
+        if (unpaired.count == 0)
+            unpaired.prevRN = m.begin()->first;
+        unpaired.count += m.size();
+    }
+};
+
+/** The state of pairing consecutive alignments of the same read. */
+struct ReadPairState {
+    std::string prevRN;
+    BarcodeKey readyToAddIndex;
+    int prevContig, readyToAddContig;
+    int prevSI, prevFlag, prevMapq, prevPos, readyToAddPos;
+    int ct;
+    UnpairedReads unpaired;
+    /** the reads awaiting their mates, for unsorted alignments */
+    MateBuffer mates;
+
+    ReadPairState() :
+        readyToAddIndex(NO_BARCODE), prevContig(-1), readyToAddContig(-1),
+        prevSI(0), prevFlag(0), prevMapq(0), prevPos(-1), readyToAddPos(-1),
+        ct(1) {
+    }
+};
+
 /**
- * One end of a scaffold.
- * The left (head) is true and the right (tail) is false.
+ * Barcode counts read from the alignments, or from one part of them.
+ * The barcodes are in the order they were first seen, and the contig
+ * ends of each barcode are not sorted. The parts are read concurrently
+ * and then merged in order.
+ */
+struct IndexMapPart {
+    /** maps a barcode to its position in barcodes */
+    std::unordered_map<BarcodeKey, size_t, HashBarcode> position;
+    /** maps the position of a barcode << 32 | a contig end to its position in ends */
+    std::unordered_map<uint64_t, unsigned, HashBarcode> endPosition;
+    std::vector<BarcodeKey> barcodes;
+    std::vector<std::vector<ARCS::ScafCount>> ends;
+    ARCS::IndexMultMap indexMultMap;
+
+    /** Add n read pairs of a barcode at a contig end. */
+    void add(BarcodeKey barcode, ARCS::CI end, int n)
+    {
+        auto inserted = position.insert(std::make_pair(barcode, barcodes.size()));
+        if (inserted.second) {
+            assert(barcodes.size() < (size_t(1) << 32));
+            barcodes.push_back(barcode);
+            ends.push_back(std::vector<ARCS::ScafCount>());
+        }
+        const size_t i = inserted.first->second;
+        auto jt = endPosition.insert(std::make_pair(uint64_t(i) << 32 | end, unsigned(ends[i].size())));
+        if (jt.second)
+            ends[i].push_back(ARCS::ScafCount(end, 0));
+        ends[i][jt.first->second].second += n;
+    }
+};
+
+/*
+ * The state of reading alignments that are grouped by barcode. Each
+ * barcode is finished when the next barcode begins: it is added to a
+ * batch of barcodes, whose links are counted and which is then
+ * discarded, so that memory does not grow with the number of barcodes.
+ */
+struct BarcodeStream {
+    /** The number of barcodes of a batch */
+    static const size_t BATCH_SIZE = 65536;
+
+    const ARCS::ContigToLength& contigLengths;
+    ARCS::ContigToRank contigToRank;
+
+    /** The barcode being read, and its name */
+    BarcodeKey current;
+    std::string currentName;
+
+    /** The number of barcodes, and of barcodes in the multiplicity range */
+    size_t numBarcodes, numFiltered;
+    /** The number of barcodes aligned to a contig end, which were batched */
+    size_t numEndBarcodes;
+
+    /** The barcodes of the batch that are aligned to a contig end */
+    ARCS::IndexMap batch;
+    ARCS::IndexMultMap batchMult;
+
+    /** The reads of every barcode, kept for --barcode-counts */
+    ARCS::IndexMultMap indexMultMap;
+    /** The links counted by each thread */
+    std::vector<ARCS::PairTable> tables;
+    /** The number of barcodes of each contig end, for --tsv */
+    std::vector<unsigned> barcodesPerEnd;
+    /** The barcodes of the contig ends, for -D */
+    EndBarcodeList endBarcodes;
+
+    BarcodeStream(const ARCS::ContigToLength& contigLengths) :
+        contigLengths(contigLengths), current(NO_BARCODE),
+        numBarcodes(0), numFiltered(0), numEndBarcodes(0),
+        tables(params.threads > 0 ? params.threads : 1) {}
+
+    void add(BarcodeKey index, IndexMapPart& part);
+    void finish(IndexMapPart& part);
+
+  private:
+    void finishBarcodes(IndexMapPart& part, BarcodeKey keep);
+    void addBarcode(BarcodeKey barcode, int indexMult, std::vector<ARCS::ScafCount>& ends);
+    void countBatch();
+};
+
+/* Add the length of a sequence of the SAM/BAM header to the contigs, or check it */
+static void addSequenceLength(const std::string& name, size_t size, bool addSAMSequenceLengths,
+        ARCS::ContigToLength& contigLengths)
+{
+    if (addSAMSequenceLengths) {
+        g_contigNames.insert(name);
+        contigLengths.push_back(size);
+    } else {
+        unsigned i;
+        if (!g_contigNames.find(name, i)) {
+            std::cerr << "error: unexpected sequence: " << name << " of size " << size;
+            exit(EXIT_FAILURE);
+        } else if (contigLengths[i] != (int)size) {
+            std::cerr << "error: mismatched sequence lengths: sequence "
+                << name << ": " << contigLengths[i] << " != " << size;
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Parse a line of the SAM header, and add @SQ sequence lengths to contigLengths */
+static void parseSAMHeader(const std::string& line, bool addSAMSequenceLengths,
+        ARCS::ContigToLength& contigLengths)
+{
+    if (startsWith(line, "@SQ\t")) {
+        std::stringstream ss(line);
+        std::string name;
+        size_t size = 0;
+        ss >> expect("@SQ\tSN:") >> name >> expect("\tLN:") >> size;
+        if (!ss) {
+            std::cerr << "error: parsing SAM header: " << line << '\n';
+            exit(EXIT_FAILURE);
+        }
+        addSequenceLength(name, size, addSAMSequenceLengths, contigLengths);
+    }
+}
+
+/* Return the index of the named contig, or -1 if it is not known */
+static inline int findContig(const std::string& name)
+{
+    unsigned i;
+    return g_contigNames.find(name, i) ? int(i) : -1;
+}
+
+/** The barcodes seen in the alignments */
+static BarcodeDictionary g_barcodes;
+
+/*
+ * The reads of each barcode, counted by a first pass over the
+ * alignments for --prefilter
+ */
+static ARCS::IndexMultMap g_prefilterMult;
+
+/* Return whether the prefilter counted the barcode in the -m range. */
+static inline bool passPrefilter(BarcodeKey index)
+{
+    auto it = g_prefilterMult.find(index);
+    return it != g_prefilterMult.end()
+        && it->second >= params.min_mult && it->second <= params.max_mult;
+}
+
+/* Parse the index from the readName, if it is not given by the BX tag */
+static StringRef parseReadNameIndex(const StringRef& readName)
+{
+    const char* found = readName.end();
+    while (found != readName.begin() && found[-1] != '_')
+        --found;
+    if (found != readName.begin()) {
+        StringRef index(found, readName.end() - found);
+        // Check that the barcode is composed of only ACGT.
+        if (std::find_if(index.begin(), index.end(), [](char c) {
+                    return strchr("ACGTacgt", c) == NULL; }) == index.end())
+            return index;
+    }
+    return StringRef();
+}
+
+/*
+ * Encode the index given by the BX tag, or else by the readName.
+ * Return NO_BARCODE if there is no index.
+ */
+static BarcodeKey encodeIndex(const StringRef& bx, const StringRef& readName)
+{
+    StringRef index = bx.empty() ? parseReadNameIndex(readName) : bx;
+    return index.empty() ? NO_BARCODE : g_barcodes.encode(index.data, index.size);
+}
+
+/*
+ * Return whether the position of a read pair on a contig of the
+ * specified size is in its head or tail, and set head.
+ */
+static inline bool findContigEnd(int size, int pos, bool& head)
+{
+    /*
+     * If length of sequence is less than 2 x end_length, split
+     * the sequence in half to determing head/tail
+     */
+    int cutOff = params.end_length;
+    if (cutOff == 0 || size <= cutOff * 2)
+        cutOff = size/2;
+
+    head = pos <= cutOff;
+    bool tail = !head && pos > size - cutOff;
+    return head || tail;
+}
+
+/*
+ * Add the read pair that is ready to add to indexMap, if it aligns to
+ * the head or tail of a scaffold.
+ */
+static void addReadPair(ReadPairState& st, IndexMapPart& imap,
+        const ARCS::ContigToLength& contigLengths)
+{
+    if (st.readyToAddIndex != NO_BARCODE && st.readyToAddContig >= 0
+            && (size_t)st.readyToAddContig < contigLengths.size() && st.readyToAddPos != -1
+            && (!params.prefilter || passPrefilter(st.readyToAddIndex))) {
+
+        int size = contigLengths[st.readyToAddContig];
+        if (size >= params.min_size) {
+
+           bool head;
+           if (findContigEnd(size, st.readyToAddPos, head)) {
+               /* Count the read pair at the head or tail */
+               imap.add(st.readyToAddIndex, ARCS::contigEnd(st.readyToAddContig, head), 1);
+           }
+
+        }
+    }
+    st.readyToAddIndex = NO_BARCODE;
+    st.readyToAddContig = -1;
+    st.readyToAddPos = -1;
+}
+
+/*
+ * Return whether a read may be one of a read pair that aligns to the
+ * end of a contig, given the alignment of its mate from RNEXT and
+ * PNEXT. Both reads of a pair give the same answer.
+ */
+static bool mayPairMate(const Alignment& aln, const ARCS::ContigToLength& contigLengths)
+{
+    if ((aln.flag & 0xc) != 0 // UNMAP, MUNMAP
+            || aln.contig < 0 || aln.mateContig != aln.contig
+            || (size_t)aln.contig >= contigLengths.size())
+        return false;
+    int size = contigLengths[aln.contig];
+    bool head;
+    return size >= params.min_size
+        && findContigEnd(size, (aln.pos + aln.matePos) / 2, head);
+}
+
+/*
+ * Add a read pair of unsorted alignments to indexMap if the alignments
+ * of its reads pass the filters, as addAlignment does for consecutive
+ * alignments.
+ */
+static void addMatePair(const Mate& a, const Mate& b, ReadPairState& st, IndexMapPart& imap,
+        const ARCS::ContigToLength& contigLengths)
+{
+    if (b.hasSeq && checkFlag(a.flag) && checkFlag(b.flag)
+            && a.mapq != 0 && b.mapq != 0 && a.si >= params.seq_id && b.si >= params.seq_id
+            && a.contig == b.contig && b.contig >= 0 && b.index != NO_BARCODE) {
+        st.readyToAddIndex = b.index;
+        st.readyToAddContig = b.contig;
+        st.readyToAddPos = (a.pos + b.pos)/2;
+        addReadPair(st, imap, contigLengths);
+    }
+}
+
+/*
+ * Add an alignment of unsorted alignments. The read waits in the mate
+ * buffer until its mate is read. Secondary and supplementary alignments
+ * are ignored, and so are the reads whose mate does not align near the
+ * same contig end.
+ */
+static void addMateAlignment(const Alignment& aln, ReadPairState& st, IndexMapPart& imap,
+        const ARCS::ContigToLength& contigLengths)
+{
+    if ((aln.flag & 0x900) != 0 // SECONDARY, SUPPLEMENTARY
+            || !mayPairMate(aln, contigLengths))
+        return;
+    Mate read = { aln.index, aln.contig, aln.flag, aln.pos, aln.mapq, aln.si, aln.hasSeq };
+    Mate mate;
+    if (st.mates.findMate(aln.readName, read, mate))
+        addMatePair(mate, read, st, imap, contigLengths);
+}
+
+/* Pair the unsorted alignments that are awaiting their mates. */
+static void finishMates(ReadPairState& st, IndexMapPart& imap,
+        const ARCS::ContigToLength& contigLengths)
+{
+    st.mates.pairSpilled([&](const Mate& a, const Mate& b) {
+                addMatePair(a, b, st, imap, contigLengths);
+            }, st.unpaired);
+}
+
+/** Count an unpaired read. */
+static void addUnpairedRead(ReadPairState& st, const std::string& currRN)
+{
+    if (st.unpaired.count == 0) {
+        st.unpaired.prevRN = st.prevRN;
+        st.unpaired.currRN = currRN;
+    }
+    ++st.unpaired.count;
+}
+
+/** Add the unpaired reads of a following part of the same file. */
+static void mergeUnpairedReads(const UnpairedReads& from, UnpairedReads& to)
+{
+    if (to.count == 0) {
+        to.prevRN = from.prevRN;
+        to.currRN = from.currRN;
+    }
+    to.count += from.count;
+}
+
+/** Report the unpaired reads. */
+static void reportUnpairedReads(const UnpairedReads& unpaired)
+{
+    if (unpaired.count == 0)
+        return;
+    if (params.unsorted) {
+        std::cerr << "Warning: Skipped " << unpaired.count
+            << " reads whose mates were not found, such as " << unpaired.prevRN << std::endl;
+        return;
+    }
+    std::cerr << "Warning: Skipping an unpaired read. Read pairs should be consecutive in the SAM/BAM file.\n"
+        "  Prev read: " << unpaired.prevRN << "\n"
+        "  Curr read: " << unpaired.currRN << std::endl;
+    std::cerr << "Warning: Skipped " << unpaired.count << " unpaired reads. Read pairs should be consecutive in the SAM/BAM file.\n";
+}
+
+/*
+ * Add one alignment to the read pair state. If the alignment completes
+ * a read pair that passes the filters, update indexMap.
+ */
+static void addAlignment(const Alignment& aln, ReadPairState& st, IndexMapPart& imap,
+        const ARCS::ContigToLength& contigLengths)
+{
+    const std::string& readName = aln.readName;
+
+    /* Keep track of index multiplicity, unless counted by the prefilter */
+    if (aln.index != NO_BARCODE && !params.prefilter)
+        imap.indexMultMap[aln.index]++;
+
+    if (params.unsorted) {
+        addMateAlignment(aln, st, imap, contigLengths);
+        return;
+    }
+
+    if (st.ct == 2 && readName != st.prevRN) {
+        addUnpairedRead(st, readName);
+        st.ct = 1;
+    }
+
+    if (st.ct >= 3)
+        st.ct = 1;
+    if (st.ct == 1) {
+        if (readName.compare(st.prevRN) != 0) {
+            st.prevRN = readName;
+            st.prevSI = aln.si;
+            st.prevFlag = aln.flag;
+            st.prevMapq = aln.mapq;
+            st.prevContig = aln.contig;
+            st.prevPos = aln.pos;
+
+            /*
+             * Read names are different so we can add the previous index and scafName as
+             * long as there were only two mappings (one for each read)
+             */
+            addReadPair(st, imap, contigLengths);
+        } else {
+            st.ct = 0;
+            st.readyToAddIndex = NO_BARCODE;
+            st.readyToAddContig = -1;
+            st.readyToAddPos = -1;
+        }
+    } else if (st.ct == 2) {
+        assert(readName == st.prevRN);
+        if (aln.hasSeq && checkFlag(aln.flag) && checkFlag(st.prevFlag)
+                && aln.mapq != 0 && st.prevMapq != 0 && aln.si >= params.seq_id && st.prevSI >= params.seq_id) {
+            if (st.prevContig == aln.contig && aln.contig >= 0 && aln.index != NO_BARCODE) {
+
+                st.readyToAddIndex = aln.index;
+                st.readyToAddContig = aln.contig;
+                /* Take average read alignment position between read pairs */
+                st.readyToAddPos = (st.prevPos + aln.pos)/2;
+            }
+        }
+    }
+    st.ct++;
+}
+
+/*
+ * Finish a part of the alignments that is followed by a different read,
+ * named nextRN. Complete the last read pair as the first alignment of
+ * the next read would.
+ */
+static void finishPart(ReadPairState& st, IndexMapPart& imap,
+        const ARCS::ContigToLength& contigLengths, const std::string& nextRN)
+{
+    if (st.ct == 2)
+        addUnpairedRead(st, nextRN);
+    else
+        addReadPair(st, imap, contigLengths);
+}
+
+/** Split a line of SAM text into the fields of an alignment. */
+static void parseSAMAlignment(const char* line, size_t length, SAMRecord& sam, Alignment& aln)
+{
+    /* Split the line into fields without copying them */
+    parseSAMRecord(line, length, sam);
+    aln.readName.assign(sam.qname.data, sam.qname.size);
+    aln.flag = sam.flag;
+    aln.scafName.assign(sam.rname.data, sam.rname.size);
+    aln.contig = findContig(aln.scafName);
+    aln.pos = sam.pos;
+    aln.mapq = sam.mapq;
+    if (sam.rnext == StringRef("=", 1)) {
+        aln.mateContig = aln.contig;
+    } else if (sam.rnext == StringRef("*", 1)) {
+        aln.mateContig = -1;
+    } else {
+        aln.mateName.assign(sam.rnext.data, sam.rnext.size);
+        aln.mateContig = findContig(aln.mateName);
+    }
+    aln.matePos = sam.pnext;
+
+    /* Parse the index from the readName */
+    aln.index = encodeIndex(findSAMTag(sam.tags, "BX:Z:"), aln.readName);
+
+    /* Calculate the sequence identity */
+    int edit_dist = parseSAMInt(findSAMTag(sam.tags, "NM:i:"));
+    aln.si = calcSequenceIdentity(cigarQueryLength(sam.cigar), edit_dist, sam.seq.size);
+    aln.hasSeq = !sam.seq.empty();
+}
+
+/*
+ * Read the alignments of a part of a SAM file. The part is followed
+ * by the alignments up to fileEnd.
+ */
+static void readSAMPart(const char* begin, const char* end, const char* fileEnd,
+        const ARCS::ContigToLength& contigLengths, IndexMapPart& part, UnpairedReads& unpaired)
+{
+    ReadPairState st;
+    SAMRecord sam;
+    Alignment aln;
+    for (const char* p = begin; p != end;) {
+        StringRef line = getLine(p, end);
+        p = line.end() == end ? end : line.end() + 1;
+        if (line.empty() || line.data[0] == '@')
+            continue;
+        parseSAMAlignment(line.data, line.size, sam, aln);
+        addAlignment(aln, st, part, contigLengths);
+    }
+    if (end != fileEnd) {
+        StringRef nextRN = getReadName(getLine(end, fileEnd));
+        finishPart(st, part, contigLengths, std::string(nextRN.data, nextRN.size));
+    }
+    unpaired = st.unpaired;
+}
+
+/*
+ * Merge the barcode counts of a following part into another part.
+ * The new barcodes are added in the order they were first seen, so
+ * that merging the parts in order yields the same indexMap as reading
+ * them serially.
+ */
+static void mergeIndexMap(IndexMapPart& from, IndexMapPart& to)
+{
+    if (to.barcodes.empty() && to.indexMultMap.empty()) {
+        std::swap(from, to);
+        return;
+    }
+
+    for (const auto& x : from.indexMultMap)
+        to.indexMultMap[x.first] += x.second;
+
+    for (size_t i = 0; i < from.barcodes.size(); ++i)
+        for (const auto& x : from.ends[i])
+            to.add(from.barcodes[i], x.first, x.second);
+    from = IndexMapPart();
+}
+
+/*
+ * Store the barcode counts in an IndexMap, sorting the contig ends of
+ * each barcode.
+ */
+static void freezeIndexMap(IndexMapPart& part, ARCS::IndexMap& imap)
+{
+    part.endPosition.clear();
+
+    size_t numEnds = 0;
+    for (const auto& x : part.ends)
+        numEnds += x.size();
+
+    ARCS::IndexMap frozen;
+    frozen.reserve(part.barcodes.size(), numEnds);
+    for (size_t i = 0; i < part.barcodes.size(); ++i) {
+        std::vector<ARCS::ScafCount>& ends = part.ends[i];
+        std::sort(ends.begin(), ends.end());
+        frozen.push_back(part.barcodes[i], ends);
+        std::vector<ARCS::ScafCount>().swap(ends);
+    }
+    imap.swap(frozen);
+    part.position.clear();
+    part.barcodes.clear();
+}
+
+/*
+ * Merge a list of parts into the first part. Pairs of neighbouring
+ * parts are merged in parallel, which preserves their order.
+ */
+static void mergeIndexMaps(std::vector<IndexMapPart>& parts)
+{
+    for (size_t step = 1; step < parts.size(); step *= 2) {
+#pragma omp parallel for num_threads(params.threads) schedule(dynamic)
+        for (size_t i = 0; i < parts.size() - step; i += 2 * step)
+            mergeIndexMap(parts[i + step], parts[i]);
+    }
+}
+
+/** Return whether the data looks like SAM text rather than compressed data. */
+static bool isSAMText(const char* p, const char* end)
+{
+    StringRef line = getLine(p, std::min(end, p + 65536));
+    for (const char* q = line.begin(); q != line.end(); ++q)
+        if ((unsigned char)*q < ' ' && *q != '\t' && *q != '\r')
+            return false;
+    return !line.empty() && (line.data[0] == '@'
+            || std::count(line.begin(), line.end(), '\t') >= 10);
+}
+
+/*
+ * Split the alignments of a SAM file that begin at body into parts for
+ * the threads, at read boundaries. Return the bounds of the parts.
+ */
+static std::vector<const char*> splitSAMParts(const MappedFile& in, const char* body,
+        unsigned threads)
+{
+    const size_t minPartSize = 1 << 20;
+    size_t numParts = std::min<size_t>(8 * threads,
+            std::max<size_t>(1, (in.end() - body) / minPartSize));
+    return splitSAMText(in.begin(), body, in.end(), numParts);
+}
+
+/*
+ * Read a SAM file using multiple threads. The file is mapped into
+ * memory and split into parts at read boundaries, each part is read
+ * by one thread, and the parts are merged in order.
+ * @return false if the file is not a regular uncompressed SAM file
+ */
+static bool readSAMParallel(const std::string& bamName, IndexMapPart& out, UnpairedReads& unpaired,
+        ARCS::ContigToLength& contigLengths, unsigned threads)
+{
+    MappedFile in;
+    if (!in.open(bamName) || !isSAMText(in.begin(), in.end()))
+        return false;
+
+    // Whether to add SAM SQ headers to the contigs.
+    const bool addSAMSequenceLengths = g_contigNames.empty();
+
+    /* Parse the SAM header */
+    const char* body = in.begin();
+    std::string line;
+    while (body != in.end() && (*body == '@' || *body == '\n')) {
+        StringRef ref = getLine(body, in.end());
+        line.assign(ref.data, ref.size);
+        if (!line.empty())
+            parseSAMHeader(line, addSAMSequenceLengths, contigLengths);
+        body = ref.end() == in.end() ? in.end() : ref.end() + 1;
+    }
+
+    /* Split the alignments into parts */
+    std::vector<const char*> bounds = splitSAMParts(in, body, threads);
+    size_t numParts = bounds.size() - 1;
+
+    /* Read the parts */
+    std::vector<IndexMapPart> parts(numParts);
+    std::vector<UnpairedReads> partUnpaired(numParts);
+#pragma omp parallel for num_threads(threads) schedule(dynamic)
+    for (size_t i = 0; i < numParts; ++i)
+        readSAMPart(bounds[i], bounds[i + 1], in.end(), contigLengths, parts[i], partUnpaired[i]);
+
+    /* Merge the parts in order */
+    mergeIndexMaps(parts);
+    mergeIndexMap(parts.front(), out);
+    for (const auto& x : partUnpaired)
+        mergeUnpairedReads(x, unpaired);
+
+    if (params.verbose)
+        std::cout << "Read " << numParts << " parts of " << bamName << std::endl;
+    return true;
+}
+
+/*
+ * Read a BAM file using the native BGZF/BAM decoder, and update
+ * indexMap as readBAM does for SAM.
+ */
+static UnpairedReads readBinaryBAM(const std::string& bamName, IndexMapPart& out,
+        ARCS::ContigToLength& contigLengths, unsigned threads, BarcodeStream* stream)
+{
+    BamReader in(bamName, threads);
+
+    // Whether to add BAM reference sequence lengths to the contigs.
+    const bool addSAMSequenceLengths = g_contigNames.empty();
+    for (const auto& ref : in.references())
+        addSequenceLength(ref.first, ref.second, addSAMSequenceLengths, contigLengths);
+
+    /* Map the BAM reference IDs to contig indices */
+    const std::vector<BamReader::Reference>& refs = in.references();
+    std::vector<int> refContigs;
+    refContigs.reserve(refs.size());
+    for (const auto& ref : refs)
+        refContigs.push_back(findContig(ref.first));
+
+    ReadPairState st;
+    Alignment aln;
+    BamRecord rec;
+    size_t linecount = 0;
+    while (in.read(rec)) {
+        linecount++;
+
+        aln.readName.assign(rec.readName);
+        aln.flag = rec.flag;
+        aln.mapq = rec.mapq;
+        /* Convert to the 1-based position of SAM, in which unmapped is 0 */
+        aln.pos = rec.pos + 1;
+        if (rec.refID >= 0 && (size_t)rec.refID < refContigs.size())
+            aln.contig = refContigs[rec.refID];
+        else
+            aln.contig = -1;
+        if (rec.next_refID >= 0 && (size_t)rec.next_refID < refContigs.size())
+            aln.mateContig = refContigs[rec.next_refID];
+        else
+            aln.mateContig = -1;
+        aln.matePos = rec.next_pos + 1;
+        /* An empty SEQ is `*` in SAM, which has length 1 */
+        aln.hasSeq = true;
+        aln.si = calcSequenceIdentity(rec.qalen, rec.nm, rec.l_seq > 0 ? rec.l_seq : 1);
+
+        aln.index = encodeIndex(StringRef(rec.bx, rec.l_bx), aln.readName);
+
+        addAlignment(aln, st, out, contigLengths);
+        if (stream != NULL)
+            stream->add(aln.index, out);
+
+        if (params.verbose && linecount % 10000000 == 0)
+            std::cout << "On line " << linecount << std::endl;
+    }
+    if (params.unsorted)
+        finishMates(st, out, contigLengths);
+    if (stream != NULL)
+        stream->finish(out);
+
+    return st.unpaired;
+}
+
+/*
+ * Read BAM file, if sequence identity greater than threashold
+ * update indexMap. IndexMap also stores information about
+ * contig number index algins with and counts. The file is decoded by
+ * at most the given number of threads. If stream is not null, each
+ * barcode is passed to it when it is finished.
+ */
+UnpairedReads readBAM(const std::string bamName, IndexMapPart& out,
+        ARCS::ContigToLength& contigLengths, unsigned threads,
+        BarcodeStream* stream = NULL)
+{
+    if (endsWith(bamName, ".bam"))
+        return readBinaryBAM(bamName, out, contigLengths, threads, stream);
+
+    UnpairedReads unpaired;
+    if (threads > 1 && stream == NULL && !params.unsorted
+            && readSAMParallel(bamName, out, unpaired, contigLengths, threads))
+        return unpaired;
+
+    /* Open BAM file */
+    std::ifstream bamName_stream;
+    bamName_stream.open(bamName.c_str());
+    assert_good(bamName_stream, bamName);
+    if (bamName_stream.peek() == EOF) {
+        std::cerr << "error: alignments file is empty: " << bamName << '\n';
+        exit(EXIT_FAILURE);
+    }
+
+    ReadPairState st;
+    Alignment aln;
+    SAMRecord sam;
+
+    std::string line;
+    size_t linecount = 0;
+
+    // Whether to add SAM SQ headers to the contigs.
+    const bool addSAMSequenceLengths = g_contigNames.empty();
+
+    /* Read each line of the BAM file */
+    while (getline(bamName_stream, line)) {
+        if (line.empty())
+            continue;
+        if (line[0] == '@') {
+            // Parse the SAM header.
+            parseSAMHeader(line, addSAMSequenceLengths, contigLengths);
+        } else {
+            linecount++;
+
+            parseSAMAlignment(line.data(), line.size(), sam, aln);
+            addAlignment(aln, st, out, contigLengths);
+            if (stream != NULL)
+                stream->add(aln.index, out);
+
+            if (params.verbose && linecount % 10000000 == 0)
+                std::cout << "On line " << linecount << std::endl;
+
+        }
+        assert(bamName_stream);
+    }
+
+    /* Close BAM file */
+    assert_eof(bamName_stream, bamName);
+    bamName_stream.close();
+    if (params.unsorted)
+        finishMates(st, out, contigLengths);
+    if (stream != NULL)
+        stream->finish(out);
+
+    return st.unpaired;
+}
+
+/**
+ * Read the file of file names.
+ */
+static std::vector<std::string> readFof(const std::string& fofName)
+{
+    std::vector<std::string> filenames;
+    if (fofName.empty())
+      return filenames;
+    std::ifstream fin(fofName);
+    assert_good(fin, fofName);
+    for (std::string bamName; getline(fin, bamName);)
+        filenames.push_back(bamName);
+    assert_eof(fin, fofName);
+    if (filenames.empty()) {
+        cerr << PROGRAM ": error: " << fofName << " is empty" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    for (const auto& filename : filenames)
+      assert_readable(filename);
+    return filenames;
+}
+
+/** Return whether the file is a regular file, which may be read twice. */
+static bool isRegularFile(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/*
+ * Add the contigs of the SAM header of an alignments file.
+ * Return false if the file has no @SQ header.
+ */
+static bool readSAMHeaderContigs(const std::string& bamName, ARCS::ContigToLength& contigLengths)
+{
+    assert(g_contigNames.empty());
+    if (endsWith(bamName, ".bam")) {
+        BamReader in(bamName, 1);
+        for (const auto& ref : in.references())
+            addSequenceLength(ref.first, ref.second, true, contigLengths);
+    } else {
+        std::ifstream in(bamName.c_str());
+        assert_good(in, bamName);
+        for (std::string line; getline(in, line);) {
+            if (line.empty())
+                continue;
+            if (line[0] != '@')
+                break;
+            parseSAMHeader(line, true, contigLengths);
+        }
+    }
+    return !g_contigNames.empty();
+}
+
+/**
+ * Read the BAM files. When there are fewer files than threads, the
+ * files are read one after another, each by all of the threads.
+ * Otherwise the files are read concurrently, each by one thread,
+ * since a parallel region nested in another runs on one thread.
+ */
+void readBAMS(const std::vector<std::string> bamNames, ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap,
+        ARCS::ContigToLength& contigLengths)
+{
+    assert(!bamNames.empty());
+    IndexMapPart all;
+    if (bamNames.size() < params.threads || params.threads <= 1
+            || !std::all_of(bamNames.begin(), bamNames.end(), isRegularFile)) {
+        for (const auto& bamName : bamNames) {
+            if (params.verbose)
+                std::cout << "Reading alignments: " << bamName << std::endl;
+            reportUnpairedReads(readBAM(bamName, all, contigLengths, params.threads));
+        }
+    } else {
+        /*
+         * Read the files concurrently, each into its own part. Unless
+         * the contigs are already known, they are given by the first
+         * file with a SAM header, whose header is read beforehand.
+         * The files that precede it are read without any contigs,
+         * as if the files had been read one after another.
+         */
+        const size_t n = bamNames.size();
+        size_t first = 0;
+        if (g_contigNames.empty())
+            while (first < n && !readSAMHeaderContigs(bamNames[first], contigLengths))
+                ++first;
+
+        ARCS::ContigToLength noContigs;
+        std::vector<IndexMapPart> parts(n);
+        std::vector<UnpairedReads> unpaired(n);
+        if (params.verbose)
+            for (const auto& bamName : bamNames)
+                std::cout << "Reading alignments: " << bamName << std::endl;
+#pragma omp parallel for num_threads(params.threads) schedule(dynamic)
+        for (size_t i = 0; i < n; ++i) {
+            unpaired[i] = readBAM(bamNames[i], parts[i],
+                    i < first ? noContigs : contigLengths, 1);
+        }
+        for (const auto& x : unpaired)
+            reportUnpairedReads(x);
+
+        mergeIndexMaps(parts);
+        std::swap(all, parts.front());
+    }
+    std::swap(indexMultMap, all.indexMultMap);
+    freezeIndexMap(all, imap);
+}
+
+/**
+ * Read one alignments file that is grouped by barcode, passing each
+ * barcode to the stream when it is finished.
+ */
+static void readBarcodeSorted(const std::vector<std::string>& bamNames, BarcodeStream& stream,
+        ARCS::ContigToLength& contigLengths)
+{
+    if (bamNames.size() != 1) {
+        std::cerr << PROGRAM ": error: --barcode-sorted requires one alignments file\n";
+        exit(EXIT_FAILURE);
+    }
+    if (params.verbose)
+        std::cout << "Reading alignments: " << bamNames.front() << std::endl;
+    IndexMapPart part;
+    reportUnpairedReads(readBAM(bamNames.front(), part, contigLengths, params.threads, &stream));
+}
+
+/** Return the barcode of a line of SAM text, or NO_BARCODE. */
+static inline BarcodeKey parseSAMBarcode(const StringRef& line, SAMRecord& sam)
+{
+    parseSAMRecord(line.data, line.size, sam);
+    return encodeIndex(findSAMTag(sam.tags, "BX:Z:"), sam.qname);
+}
+
+/*
+ * Count the reads of each barcode of an alignments file for --prefilter,
+ * without pairing them. A SAM file is mapped into memory and its parts
+ * are counted by multiple threads.
+ */
+static void countBarcodeReads(const std::string& bamName, ARCS::IndexMultMap& indexMultMap)
+{
+    if (!isRegularFile(bamName)) {
+        std::cerr << PROGRAM ": error: --prefilter reads the alignments twice, "
+            "which must be a regular file: " << bamName << '\n';
+        exit(EXIT_FAILURE);
+    }
+
+    if (endsWith(bamName, ".bam")) {
+        BamReader in(bamName, params.threads);
+        BamRecord rec;
+        while (in.read(rec)) {
+            BarcodeKey index = encodeIndex(StringRef(rec.bx, rec.l_bx),
+                    StringRef(rec.readName, strlen(rec.readName)));
+            if (index != NO_BARCODE)
+                ++indexMultMap[index];
+        }
+        return;
+    }
+
+    MappedFile mapped;
+    if (!mapped.open(bamName) || !isSAMText(mapped.begin(), mapped.end())) {
+        /* A compressed SAM file */
+        std::ifstream in(bamName.c_str());
+        assert_good(in, bamName);
+        SAMRecord sam;
+        for (std::string line; getline(in, line);) {
+            if (line.empty() || line[0] == '@')
+                continue;
+            BarcodeKey index = parseSAMBarcode(line, sam);
+            if (index != NO_BARCODE)
+                ++indexMultMap[index];
+        }
+        assert_eof(in, bamName);
+        return;
+    }
+
+    std::vector<const char*> bounds = splitSAMParts(mapped, mapped.begin(), params.threads);
+    std::vector<ARCS::IndexMultMap> parts(bounds.size() - 1);
+#pragma omp parallel for num_threads(params.threads) schedule(dynamic)
+    for (size_t i = 0; i < parts.size(); ++i) {
+        SAMRecord sam;
+        const char* end = bounds[i + 1];
+        for (const char* p = bounds[i]; p != end;) {
+            StringRef line = getLine(p, end);
+            p = line.end() == end ? end : line.end() + 1;
+            if (line.empty() || line.data[0] == '@')
+                continue;
+            BarcodeKey index = parseSAMBarcode(line, sam);
+            if (index != NO_BARCODE)
+                ++parts[i][index];
+        }
+    }
+    for (const auto& part : parts)
+        for (const auto& x : part)
+            indexMultMap[x.first] += x.second;
+}
+
+/** Rank the contigs by their FASTA IDs. */
+static ARCS::ContigToRank rankContigNames()
+{
+    const unsigned n = g_contigNames.size();
+    std::vector<unsigned> sorted(n);
+    for (unsigned i = 0; i < n; ++i)
+        sorted[i] = i;
+    std::sort(sorted.begin(), sorted.end(), [](unsigned a, unsigned b) {
+                return strcmp(g_contigNames.getName(a), g_contigNames.getName(b)) < 0;
+            });
+
+    ARCS::ContigToRank rank(n);
+    for (unsigned i = 0; i < n; ++i)
+        rank[sorted[i]] = i;
+    return rank;
+}
+
+/** Report the number of barcodes. */
+static void reportBarcodeCounts(size_t unfiltered, size_t filtered, size_t endBarcodes)
+{
+    std::cout
+        << "{ \"All_barcodes_unfiltered\":" << unfiltered
+        << ", \"All_barcodes_filtered\":" << filtered
+        << ", \"Scaffold_end_barcodes\":" << endBarcodes
+        << ", \"Min_barcode_reads_threshold\":" << params.min_mult
+        << ", \"Max_barcode_reads_threshold\":" << params.max_mult
+        << " }\n";
+}
+
+/** Count barcodes. */
+static size_t countBarcodes(const ARCS::IndexMap& imap, const ARCS::IndexMultMap& indexMultMap)
+{
+    size_t barcodeCount = 0;
+    for (auto x : indexMultMap)
+        if (x.second >= params.min_mult && x.second <= params.max_mult)
+            ++barcodeCount;
+
+    reportBarcodeCounts(indexMultMap.size(), barcodeCount, imap.size());
+    return barcodeCount;
+}
+
+/*
+ * The critical values of the head or tail and link orientation tests,
+ * which depend only on -r. The table is built on first use, after the
+ * options are parsed.
+ */
+static const BinomialCriticalValues& criticalValues() {
+    static const BinomialCriticalValues table(0.5, params.error_percent);
+    return table;
+}
+
+/*
+ * Based on number of read pairs that align to the
+ * head or tail of scaffold, determine if is significantly
+ * different from a uniform distribution (p=0.5)
+ */
+std::pair<bool, bool> headOrTail(int head, int tail) {
+    int max = std::max(head, tail);
+    int sum = head + tail;
+    if (sum < params.min_reads) {
+        return std::pair<bool, bool> (false, false);
+    }
+    if (criticalValues().significant(max, sum)) {
+        bool isHead = (max == head);
+        return std::pair<bool, bool> (true, isHead);
+    } else {
+        return std::pair<bool, bool> (false, false);
+    }
+}
+
+/*
+ * Find the contig ends of a barcode that pass the head or tail test,
+ * sorted by the FASTA IDs of the contigs.
+ */
+static void findBarcodeValidEnds(const ARCS::ScafMap& scafMap, const ARCS::ContigToRank& contigToRank,
+        std::vector<ARCS::CI>& ends)
+{
+    /* The head and tail of a contig are adjacent in ScafMap */
+    ends.clear();
+    for (auto o = scafMap.begin(); o != scafMap.end();) {
+        unsigned scaf = ARCS::contigIndex(o->first);
+        int head = 0, tail = 0;
+        for (; o != scafMap.end() && ARCS::contigIndex(o->first) == scaf; ++o)
+            (ARCS::isHead(o->first) ? head : tail) = o->second;
+
+        bool valid, scafHead;
+        std::tie(valid, scafHead) = headOrTail(head, tail);
+        if (valid)
+            ends.push_back(ARCS::contigEnd(scaf, scafHead));
+    }
+    std::sort(ends.begin(), ends.end(), [&contigToRank](ARCS::CI a, ARCS::CI b) {
+                return contigToRank[ARCS::contigIndex(a)] < contigToRank[ARCS::contigIndex(b)];
+            });
+}
+
+/*
+ * Find the valid contig ends of every barcode. Barcodes outside of the
+ * multiplicity range have none. Each thread reads a contiguous block
+ * of barcodes, and the blocks are concatenated in order. If endBarcodes
+ * is not null, the contig ends of each barcode that are valid for
+ * distance estimates are added to it in the same pass, the barcodes
+ * numbered from firstIndex.
  */
-typedef std::pair<std::string, bool> ScaffoldEnd;
+static void findValidEnds(const ARCS::IndexMap& imap, const ARCS::IndexMultMap& indexMultMap,
+        const ARCS::ContigToRank& contigToRank, const ARCS::ContigToLength& contigLengths,
+        ARCS::ValidEnds& validEnds, EndBarcodeList* endBarcodes = NULL, size_t firstIndex = 0)
+{
+    assert(endBarcodes == NULL
+            || firstIndex + imap.size() <= std::numeric_limits<uint32_t>::max());
+    std::vector<ARCS::ValidEnds> blocks(params.threads > 0 ? params.threads : 1);
+    std::vector<EndBarcodeList> lists(endBarcodes != NULL ? blocks.size() : 0);
+
+#pragma omp parallel num_threads(blocks.size())
+    {
+        std::vector<ARCS::CI> ends;
+#if _OPENMP
+        const size_t t = omp_get_thread_num();
+#else
+        const size_t t = 0;
+#endif
+        ARCS::ValidEnds& block = blocks[t];
+
+#pragma omp for schedule(static)
+        for (size_t i = 0; i < imap.size(); ++i) {
+            int indexMult = indexMultMap.at(imap.barcode(i));
+            if (indexMult >= params.min_mult && indexMult <= params.max_mult) {
+                findBarcodeValidEnds(imap[i], contigToRank, ends);
+                if (endBarcodes != NULL)
+                    listEndBarcodes(imap[i], firstIndex + i, contigLengths, params, lists[t]);
+            } else
+                ends.clear();
+            block.push_back(ends);
+        }
+    }
 
-/** Hash a ScaffoldEnd. */
-struct HashScaffoldEnd {
-    size_t operator()(const ScaffoldEnd& key) const {
-        return std::hash<std::string>()(key.first) ^ key.second;
+    ARCS::ValidEnds all;
+    for (const auto& block : blocks)
+        all.append(block);
+    assert(all.size() == imap.size());
+    std::swap(validEnds, all);
+
+    for (auto& list : lists) {
+        endBarcodes->insert(endBarcodes->end(), list.begin(), list.end());
+        EndBarcodeList().swap(list);
     }
-};
+}
 
-/** Check if SAM flag is one of the accepted ones. */
-static inline bool checkFlag(int flag)
+/*
+ * Merge two sorted PairMaps into the second, adding the counts of the
+ * pairs present in both.
+ */
+template <typename Less>
+static void mergePairMaps(ARCS::PairMap& from, ARCS::PairMap& to, Less less)
 {
-    flag &= ~0xc0; // clear READ1,READ2
-    return flag == 19 // PAIRED,PROPER_PAIR,REVERSE
-        || flag == 35; // PAIRED,PROPER_PAIR,MREVERSE
+    ARCS::PairMap merged;
+    merged.reserve(from.size() + to.size());
+    auto it = from.begin(), jt = to.begin();
+    while (it != from.end() && jt != to.end()) {
+        if (less(*it, *jt))
+            merged.push_back(*it++);
+        else if (less(*jt, *it))
+            merged.push_back(*jt++);
+        else {
+            merged.push_back(*jt);
+            for (unsigned k = 0; k < 4; ++k)
+                merged.back().second[k] += it->second[k];
+            ++it;
+            ++jt;
+        }
+    }
+    merged.insert(merged.end(), it, from.end());
+    merged.insert(merged.end(), jt, to.end());
+    to.swap(merged);
+    ARCS::PairMap().swap(from);
 }
 
 /*
- * Check if character is one of the accepted ones.
+ * Sort the pairs of the tables, one per thread, and merge them into a
+ * PairMap, adding their counts. Neighbouring parts are merged in
+ * parallel, so the result does not depend on the number of threads.
  */
-bool checkChar(char c) {
-    return (c == 'M' || c == '=' || c == 'X' || c == 'I');
+template <typename Less>
+static void mergePairTables(std::vector<ARCS::PairTable>& tables, ARCS::PairMap& pmap, Less less)
+{
+    std::vector<ARCS::PairMap> parts(tables.size());
+#pragma omp parallel for num_threads(tables.size())
+    for (size_t t = 0; t < tables.size(); ++t) {
+        tables[t].appendTo(parts[t]);
+        ARCS::PairTable().swap(tables[t]);
+        std::sort(parts[t].begin(), parts[t].end(), less);
+    }
+    for (size_t step = 1; step < parts.size(); step *= 2) {
+#pragma omp parallel for num_threads(tables.size()) schedule(dynamic)
+        for (size_t i = 0; i < parts.size() - step; i += 2 * step)
+            mergePairMaps(parts[i + step], parts[i], less);
+    }
+    pmap.swap(parts.front());
 }
 
 /*
- * Calculate the sequence identity from the cigar string
- * sequence length, and tags.
+ * Count the links of the contig pairs of each barcode in the tables,
+ * one per thread. The barcodes are divided among the threads, largest
+ * first.
  */
-double calcSequenceIdentity(const std::string& line, const std::string& cigar, const std::string& seq) {
-
-    int qalen = 0;
-    std::stringstream ss;
-    for (auto i = cigar.begin(); i != cigar.end(); ++i) {
-        if (!isdigit(*i)) {
-            if (checkChar(*i)) {
-                ss << "\t";
-                int value = 0;
-                ss >> value;
-                qalen += value;
-                ss.str("");
-            } else {
-                ss.str("");
+static void countLinks(const ARCS::ValidEnds& validEnds, std::vector<ARCS::PairTable>& tables)
+{
+    /* The barcodes with at least one pair, in decreasing number of pairs */
+    std::vector<size_t> order;
+    for (size_t i = 0; i < validEnds.size(); ++i)
+        if (validEnds.size(i) >= 2)
+            order.push_back(i);
+    std::sort(order.begin(), order.end(), [&validEnds](size_t a, size_t b) {
+                return validEnds.size(a) > validEnds.size(b);
+            });
+
+#pragma omp parallel num_threads(tables.size())
+    {
+#if _OPENMP
+        ARCS::PairTable& table = tables[omp_get_thread_num()];
+#else
+        ARCS::PairTable& table = tables[0];
+#endif
+
+#pragma omp for schedule(dynamic, 16)
+        for (size_t k = 0; k < order.size(); ++k) {
+            size_t i = order[k];
+
+            /* Iterate through the pairs of scaffolds with scafA < scafB */
+            for (auto a = validEnds.begin(i); a != validEnds.end(i); ++a) {
+                for (auto b = a + 1; b != validEnds.end(i); ++b) {
+                    /* Head - Head, Head - Tail, Tail - Head, Tail - Tail */
+                    unsigned orientation = (ARCS::isHead(*a) ? 0 : 2) + (ARCS::isHead(*b) ? 0 : 1);
+                    table[ARCS::ContigPair(ARCS::contigIndex(*a), ARCS::contigIndex(*b))][orientation]++;
+                }
             }
-        } else {
-            ss << *i;
         }
     }
-
-    int edit_dist = 0;
-    std::size_t found = line.find("NM:i:");
-    if (found!=std::string::npos) {
-        edit_dist = std::strtol(&line[found + 5], 0, 10);
-    }
-
-    double si = 0;
-    if (qalen != 0) {
-        double mins = qalen - edit_dist;
-        double div = mins/seq.length();
-        si = div * 100;
-    }
-
-    return si;
 }
 
+/*
+ * Merge the links counted by countLinks into PairMap, so that the
+ * result does not depend on the number of threads.
+ */
+static void mergeLinks(std::vector<ARCS::PairTable>& tables, const ARCS::ContigToRank& contigToRank,
+        ARCS::PairMap& pmap)
+{
+    const ARCS::ContigPairByName byName(contigToRank);
+    mergePairTables(tables, pmap,
+            [&byName](const ARCS::PairMap::value_type& a, const ARCS::PairMap::value_type& b) {
+                return byName(a.first, b.first);
+            });
+}
 
-/* Get all scaffold sizes from FASTA file */
-void getScaffSizes(std::string file, ARCS::ScaffSizeList& scaffSizes) {
+/*
+ * Count the links of the contig pairs of each barcode in a PairTable
+ * per thread, and merge the tables into PairMap.
+ */
+static void pairContigsHash(const ARCS::ValidEnds& validEnds, const ARCS::ContigToRank& contigToRank,
+        ARCS::PairMap& pmap)
+{
+    std::vector<ARCS::PairTable> tables(params.threads > 0 ? params.threads : 1);
+    countLinks(validEnds, tables);
+    mergeLinks(tables, contigToRank, pmap);
+}
 
-    int counter = 0;
-    FastaReader in(file.c_str(), FastaReader::FOLD_CASE);
-    for (FastaRecord rec; in >> rec;) {
-        counter++;
-        std::string  scafName = rec.id;
-        int size = rec.seq.length();
-        scaffSizes.push_back(std::make_pair(rec.id, size));
+/* Count the barcodes aligned with at least -c read pairs to each contig end. */
+static void countEndBarcodes(const ARCS::IndexMap& imap, std::vector<unsigned>& barcodesPerEnd)
+{
+    barcodesPerEnd.resize(2 * g_contigNames.size());
+    for (size_t i = 0; i < imap.size(); ++i) {
+        for (const auto& scaffold_count : imap[i]) {
+            const auto& scaffold = scaffold_count.first;
+            const auto& count = scaffold_count.second;
+            if (count >= params.min_reads)
+               ++barcodesPerEnd[scaffold];
+        }
     }
-
-    if (params.verbose)
-        std::cout << "Saw " << counter << " sequences.\n";
 }
 
 /*
- * Read BAM file, if sequence identity greater than threashold
- * update indexMap. IndexMap also stores information about
- * contig number index algins with and counts.
+ * Begin the barcode of the next alignment. If it differs from the
+ * current barcode, finish the barcodes of part but this one. The
+ * barcodes must be in increasing order, so that none is seen again
+ * after it is finished.
  */
-void readBAM(const std::string bamName, ARCS::IndexMap& imap, std::unordered_map<std::string, int>& indexMultMap,
-        ARCS::ScaffSizeList& scaffSizeList, ARCS::ScaffSizeMap& sMap)
+void BarcodeStream::add(BarcodeKey index, IndexMapPart& part)
 {
-    /* Open BAM file */
-    std::ifstream bamName_stream;
-    bamName_stream.open(bamName.c_str());
-    assert_good(bamName_stream, bamName);
-    if (bamName_stream.peek() == EOF) {
-        std::cerr << "error: alignments file is empty: " << bamName << '\n';
+    if (index == NO_BARCODE || index == current)
+        return;
+    std::string name = g_barcodes.decode(index);
+    if (current != NO_BARCODE && name < currentName) {
+        std::cerr << PROGRAM ": error: the alignments are not sorted by barcode: "
+            << name << " follows " << currentName << '\n';
         exit(EXIT_FAILURE);
     }
+    finishBarcodes(part, index);
+    current = index;
+    currentName.swap(name);
+}
 
-    std::string prevRN = "", readyToAddIndex = "", prevRef = "", readyToAddRefName = "";
-    int prevSI = 0, prevFlag = 0, prevMapq = 0, prevPos = -1, readyToAddPos = -1;
-    int ct = 1;
+/* Finish the barcodes of part at the end of the alignments. */
+void BarcodeStream::finish(IndexMapPart& part)
+{
+    finishBarcodes(part, NO_BARCODE);
+    countBatch();
+    current = NO_BARCODE;
+    currentName.clear();
+}
 
-    std::string line;
-    size_t linecount = 0;
+/* Finish every barcode of part except keep, and remove them from part. */
+void BarcodeStream::finishBarcodes(IndexMapPart& part, BarcodeKey keep)
+{
+    for (size_t i = 0; i < part.barcodes.size(); ++i)
+        if (part.barcodes[i] != keep)
+            addBarcode(part.barcodes[i], part.indexMultMap[part.barcodes[i]], part.ends[i]);
+
+    /* The barcodes of reads that are not aligned to a contig end */
+    std::vector<ARCS::ScafCount> none;
+    for (const auto& x : part.indexMultMap)
+        if (x.first != keep && part.position.count(x.first) == 0)
+            addBarcode(x.first, x.second, none);
+
+    IndexMapPart next;
+    auto it = part.indexMultMap.find(keep);
+    if (it != part.indexMultMap.end())
+        next.indexMultMap.insert(*it);
+    auto jt = part.position.find(keep);
+    if (jt != part.position.end())
+        for (const auto& x : part.ends[jt->second])
+            next.add(keep, x.first, x.second);
+    std::swap(part, next);
+}
 
-    // Number of unpaired reads.
-    size_t countUnpaired = 0;
+/* Add a finished barcode and its contig ends to the batch. */
+void BarcodeStream::addBarcode(BarcodeKey barcode, int indexMult, std::vector<ARCS::ScafCount>& ends)
+{
+    ++numBarcodes;
+    if (indexMult >= params.min_mult && indexMult <= params.max_mult)
+        ++numFiltered;
+    if (!params.barcode_counts_name.empty())
+        indexMultMap[barcode] = indexMult;
+    if (ends.empty())
+        return;
+
+    std::sort(ends.begin(), ends.end());
+    batch.push_back(barcode, ends);
+    batchMult[barcode] = indexMult;
+    if (batch.size() >= BATCH_SIZE)
+        countBatch();
+}
 
-    // Whether to add SAM SQ headers to sMap.
-    const bool addSAMSequenceLengths = sMap.empty();
+/* Count the links of the batch, and then discard it. */
+void BarcodeStream::countBatch()
+{
+    if (batch.empty())
+        return;
+
+    /* The contigs are known once the header has been read */
+    if (contigToRank.size() != g_contigNames.size())
+        contigToRank = rankContigNames();
+
+    ARCS::ValidEnds validEnds;
+    findValidEnds(batch, batchMult, contigToRank, contigLengths, validEnds,
+            params.dist_est ? &endBarcodes : NULL, numEndBarcodes);
+    countLinks(validEnds, tables);
+    countEndBarcodes(batch, barcodesPerEnd);
+
+    numEndBarcodes += batch.size();
+    ARCS::IndexMap().swap(batch);
+    ARCS::IndexMultMap().swap(batchMult);
+}
 
-    /* Read each line of the BAM file */
-    while (getline(bamName_stream, line)) {
-        if (line.empty())
-            continue;
-        if (line[0] == '@') {
-            // Parse the SAM header.
-            if (startsWith(line, "@SQ\t")) {
-                std::stringstream ss(line);
-                std::string name;
-                size_t size = 0;
-                ss >> expect("@SQ\tSN:") >> name >> expect("\tLN:") >> size;
-                if (!ss) {
-                    std::cerr << "error: parsing SAM header: " << line << '\n';
-                    exit(EXIT_FAILURE);
-                }
-                if (addSAMSequenceLengths) {
-                    ARCS::ScaffSizeMap::value_type sq_ln(name, size);
-                    scaffSizeList.push_back(sq_ln);
-                    sMap.insert(sq_ln);
-                } else {
-                    auto it = sMap.find(name);
-                    if (it == sMap.end()) {
-                        std::cerr << "error: unexpected sequence: " << name << " of size " << size;
-                        exit(EXIT_FAILURE);
-                    } else if (it->second != (int)size) {
-                        std::cerr << "error: mismatched sequence lengths: sequence "
-                            << name << ": " << it->second << " != " << size;
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            }
-        } else {
-            linecount++;
+/*
+ * List the barcodes of each contig from the valid contig ends of each
+ * barcode. The barcodes of contig c are entries[offsets[c]] up to
+ * entries[offsets[c + 1]], each the barcode index << 1 | head, sorted
+ * by barcode index.
+ */
+static void listContigBarcodes(const ARCS::ValidEnds& validEnds, size_t numContigs,
+        std::vector<size_t>& offsets, std::vector<uint32_t>& entries)
+{
+    assert(validEnds.size() < (size_t(1) << 31));
+    offsets.assign(numContigs + 1, 0);
+    for (size_t i = 0; i < validEnds.size(); ++i)
+        for (auto a = validEnds.begin(i); a != validEnds.end(i); ++a)
+            offsets[ARCS::contigIndex(*a) + 1]++;
+    for (size_t c = 0; c < numContigs; ++c)
+        offsets[c + 1] += offsets[c];
+    entries.resize(offsets.back());
+    std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < validEnds.size(); ++i)
+        for (auto a = validEnds.begin(i); a != validEnds.end(i); ++a)
+            entries[next[ARCS::contigIndex(*a)]++] = uint32_t(i) << 1 | ARCS::isHead(*a);
+}
 
-            std::stringstream ss(line);
-            std::string readName, scafName, cigar, rnext, seq, qual, tags;
-            int flag, pos, mapq, pnext, tlen;
+/*
+ * The sparse accumulator of a row of the links: an open-addressing hash
+ * table of the contigs of the row and their counts. The slots that are
+ * used are listed, so that clearing the table takes the time of the
+ * row, and the table has the size of the largest row.
+ */
+class RowAccumulator {
+  public:
+    RowAccumulator() : m_keys(1024, unsigned(EMPTY)), m_counts(1024) {}
+
+    /** Return the counts of a contig, adding the contig if it is new. */
+    ARCS::PairCounts& operator[](unsigned contig)
+    {
+        if (2 * (m_used.size() + 1) > m_keys.size())
+            grow();
+        size_t i = find(contig);
+        if (m_keys[i] == EMPTY) {
+            m_keys[i] = contig;
+            m_used.push_back(i);
+        }
+        return m_counts[i];
+    }
 
-            ss >> readName >> flag >> scafName >> pos >> mapq >> cigar
-                >> rnext >> pnext >> tlen >> seq >> qual >> std::ws;
+    /*
+     * Append the contigs of row a and their counts to a PairMap, sorted
+     * by FASTA ID, and clear the row.
+     */
+    void appendRow(unsigned a, const ARCS::ContigToRank& contigToRank, ARCS::PairMap& row)
+    {
+        std::sort(m_used.begin(), m_used.end(), [this, &contigToRank](size_t x, size_t y) {
+                    return contigToRank[m_keys[x]] < contigToRank[m_keys[y]];
+                });
+        row.reserve(row.size() + m_used.size());
+        for (size_t i : m_used) {
+            row.push_back(std::make_pair(ARCS::ContigPair(a, m_keys[i]), m_counts[i]));
+            m_keys[i] = EMPTY;
+            m_counts[i].fill(0);
+        }
+        m_used.clear();
+    }
 
-            getline(ss, tags);
+  private:
+    static const unsigned EMPTY = ~0u;
+
+    /** Return the slot of the contig, or the empty slot where it belongs. */
+    size_t find(unsigned contig) const
+    {
+        size_t mask = m_keys.size() - 1;
+        size_t i = HashBarcode()(contig) & mask;
+        while (m_keys[i] != EMPTY && m_keys[i] != contig)
+            i = (i + 1) & mask;
+        return i;
+    }
 
-            /* Parse the index from the readName */
-            std::string index = parseBXTag(tags);
-            if (index.empty()) {
-                std::size_t found = readName.rfind("_");
-                if (found != std::string::npos) {
-                    index = readName.substr(found + 1);
-                    // Check that the barcode is composed of only ACGT.
-                    if (index.find_first_not_of("ACGTacgt") != std::string::npos)
-                      index.clear();
-                }
-            }
+    /** Double the number of slots. */
+    void grow()
+    {
+        std::vector<unsigned> keys(2 * m_keys.size(), unsigned(EMPTY));
+        std::vector<ARCS::PairCounts> counts(keys.size());
+        keys.swap(m_keys);
+        counts.swap(m_counts);
+        for (size_t& i : m_used) {
+            size_t j = find(keys[i]);
+            m_keys[j] = keys[i];
+            m_counts[j] = counts[i];
+            i = j;
+        }
+    }
 
-            /* Keep track of index multiplicity */
-            if (!index.empty())
-                indexMultMap[index]++;
-
-            /* Calculate the sequence identity */
-            int si = calcSequenceIdentity(line, cigar, seq);
-
-            if (ct == 2 && readName != prevRN) {
-                if (countUnpaired == 0)
-                    std::cerr << "Warning: Skipping an unpaired read. Read pairs should be consecutive in the SAM/BAM file.\n"
-                        "  Prev read: " << prevRN << "\n"
-                        "  Curr read: " << readName << std::endl;
-                ++countUnpaired;
-                if (countUnpaired % 1000000 == 0)
-                    std::cerr << "Warning: Skipped " << countUnpaired << " unpaired reads." << std::endl;
-                ct = 1;
-            }
+    std::vector<unsigned> m_keys;
+    std::vector<ARCS::PairCounts> m_counts;
+    /** The slots that are used */
+    std::vector<size_t> m_used;
+};
 
-            if (ct >= 3)
-                ct = 1;
-            if (ct == 1) {
-                if (readName.compare(prevRN) != 0) {
-                    prevRN = readName;
-                    prevSI = si;
-                    prevFlag = flag;
-                    prevMapq = mapq;
-                    prevRef = scafName;
-                    prevPos = pos;
-
-
-                    /*
-                     * Read names are different so we can add the previous index and scafName as
-                     * long as there were only two mappings (one for each read)
-                     */
-                    if (!readyToAddIndex.empty() && !readyToAddRefName.empty() && readyToAddRefName.compare("*") != 0 && readyToAddPos != -1) {
-
-                        int size = sMap[readyToAddRefName];
-                        if (size >= params.min_size) {
-
-                           /*
-                            * If length of sequence is less than 2 x end_length, split
-                            * the sequence in half to determing head/tail
-                            */
-                           int cutOff = params.end_length;
-                           if (cutOff == 0 || size <= cutOff * 2)
-                               cutOff = size/2;
-
-                           /*
-                            * pair <X, true> indicates read pair aligns to head,
-                            * pair <X, false> indicates read pair aligns to tail
-                            */
-                           ScaffoldEnd key(readyToAddRefName, true);
-                           ScaffoldEnd keyR(readyToAddRefName, false);
-
-                           /* Aligns to head */
-                           if (readyToAddPos <= cutOff) {
-                               imap[readyToAddIndex][key]++;
-
-                               if (imap[readyToAddIndex].count(keyR) == 0)
-                                   imap[readyToAddIndex][keyR] = 0;
-
-                            /* Aligns to tail */
-                           } else if (readyToAddPos > size - cutOff) {
-                               imap[readyToAddIndex][keyR]++;
-
-                               if (imap[readyToAddIndex].count(key) == 0)
-                                   imap[readyToAddIndex][key] = 0;
-                           }
-
-                        }
-                        readyToAddIndex = "";
-                        readyToAddRefName = "";
-                        readyToAddPos = -1;
-                    }
-                } else {
-                    ct = 0;
-                    readyToAddIndex = "";
-                    readyToAddRefName = "";
-                    readyToAddPos = -1;
-                }
-            } else if (ct == 2) {
-                assert(readName == prevRN);
-                if (!seq.empty() && checkFlag(flag) && checkFlag(prevFlag)
-                        && mapq != 0 && prevMapq != 0 && si >= params.seq_id && prevSI >= params.seq_id) {
-                    if (prevRef.compare(scafName) == 0 && scafName.compare("*") != 0 && !scafName.empty() && !index.empty()) {
-
-                        readyToAddIndex = index;
-                        readyToAddRefName = scafName;
-                        /* Take average read alignment position between read pairs */
-                        readyToAddPos = (prevPos + pos)/2;
+/*
+ * Count the links as the upper triangle of the sparse product B^T B,
+ * where B is the barcode by contig incidence matrix of the valid
+ * contig ends: the rows of B are ValidEnds, and its columns list the
+ * barcodes of each contig. Row a of the product, computed with a sparse
+ * accumulator, counts the links of contig a to the contigs that follow
+ * it by FASTA ID. The rows are computed in parallel, in blocks of
+ * consecutive rows by FASTA ID, and appended to PairMap in order.
+ */
+static void pairContigsSpGEMM(const ARCS::ValidEnds& validEnds, const ARCS::ContigToRank& contigToRank,
+        ARCS::PairMap& pmap)
+{
+    /* The number of rows of the product computed at once */
+    const size_t BLOCK_SIZE = 4096;
+
+    const size_t numContigs = contigToRank.size();
+
+    /* The columns of B */
+    std::vector<size_t> colOffsets;
+    std::vector<uint32_t> colEntries;
+    listContigBarcodes(validEnds, numContigs, colOffsets, colEntries);
+
+    /* The contigs sorted by FASTA ID */
+    std::vector<unsigned> sorted(numContigs);
+    for (unsigned c = 0; c < numContigs; ++c)
+        sorted[contigToRank[c]] = c;
+
+    const unsigned threads = params.threads > 0 ? params.threads : 1;
+    std::vector<ARCS::PairMap> rows(BLOCK_SIZE);
+    pmap.clear();
+
+#pragma omp parallel num_threads(threads)
+    {
+        RowAccumulator acc;
+
+        for (size_t block = 0; block < numContigs; block += BLOCK_SIZE) {
+            const size_t blockEnd = std::min(numContigs, block + BLOCK_SIZE);
+
+#pragma omp for schedule(dynamic, 1)
+            for (size_t r = block; r < blockEnd; ++r) {
+                const unsigned a = sorted[r];
+                const unsigned rankA = contigToRank[a];
+                for (size_t k = colOffsets[a]; k < colOffsets[a + 1]; ++k) {
+                    const size_t i = colEntries[k] >> 1;
+                    const bool headA = colEntries[k] & 1;
+
+                    /* The ends of barcode i are sorted by FASTA ID */
+                    auto b = std::upper_bound(validEnds.begin(i), validEnds.end(i), rankA,
+                            [&contigToRank](unsigned rank, ARCS::CI end) {
+                                return rank < contigToRank[ARCS::contigIndex(end)];
+                            });
+                    for (; b != validEnds.end(i); ++b) {
+                        /* Head - Head, Head - Tail, Tail - Head, Tail - Tail */
+                        acc[ARCS::contigIndex(*b)][(headA ? 0 : 2) + (ARCS::isHead(*b) ? 0 : 1)]++;
                     }
                 }
+                acc.appendRow(a, contigToRank, rows[r - block]);
             }
-           ct++;
-
-            if (params.verbose && linecount % 10000000 == 0)
-                std::cout << "On line " << linecount << std::endl;
 
+#pragma omp single
+            for (size_t r = block; r < blockEnd; ++r) {
+                ARCS::PairMap& row = rows[r - block];
+                pmap.insert(pmap.end(), row.begin(), row.end());
+                ARCS::PairMap().swap(row);
+            }
         }
-        assert(bamName_stream);
     }
-
-    /* Close BAM file */
-    assert_eof(bamName_stream, bamName);
-    bamName_stream.close();
-
-    if (countUnpaired > 0)
-        std::cerr << "Warning: Skipped " << countUnpaired << " unpaired reads. Read pairs should be consecutive in the SAM/BAM file.\n";
 }
 
-/**
- * Read the file of file names.
+/*
+ * The most contig ends that share the key of a band and are paired.
+ * The ends of a larger bucket would add a quadratic number of pairs,
+ * such as the ends whose barcodes are mostly one common barcode.
  */
-static std::vector<std::string> readFof(const std::string& fofName)
-{
-    std::vector<std::string> filenames;
-    if (fofName.empty())
-      return filenames;
-    std::ifstream fin(fofName);
-    assert_good(fin, fofName);
-    for (std::string bamName; getline(fin, bamName);)
-        filenames.push_back(bamName);
-    assert_eof(fin, fofName);
-    if (filenames.empty()) {
-        cerr << PROGRAM ": error: " << fofName << " is empty" << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    for (const auto& filename : filenames)
-      assert_readable(filename);
-    return filenames;
-}
+static const size_t MAX_MINHASH_BUCKET = 1000;
 
-/**
- * Read the BAM files.
+/*
+ * Find candidate pairs of contigs with MinHash sketches, and count the
+ * links of the candidates exactly. Each contig end is sketched by the
+ * barcodes for which it is valid. The sketches are divided into bands,
+ * and the ends of two contigs whose sketches are equal in at least one
+ * band are a candidate pair (locality sensitive hashing). The sketches
+ * take 4 * sketch_size bytes per contig end. The ends of a bucket larger
+ * than MAX_MINHASH_BUCKET are not paired by its band.
  */
-void readBAMS(const std::vector<std::string> bamNames, ARCS::IndexMap& imap, std::unordered_map<std::string, int>& indexMultMap,
-        ARCS::ScaffSizeList& scaffSizeList, ARCS::ScaffSizeMap& scaffSizeMap)
+static void pairContigsMinHash(const ARCS::ValidEnds& validEnds, const ARCS::ContigToRank& contigToRank,
+        ARCS::PairMap& pmap)
 {
-    assert(!bamNames.empty());
-    for (const auto& bamName : bamNames) {
-        if (params.verbose)
-            std::cout << "Reading alignments: " << bamName << std::endl;
-        readBAM(bamName, imap, indexMultMap, scaffSizeList, scaffSizeMap);
+    const size_t numContigs = contigToRank.size();
+    const size_t numEnds = 2 * numContigs;
+    const unsigned k = params.sketch_size;
+    const unsigned r = params.sketch_size / params.sketch_bands;
+    const unsigned threads = params.threads > 0 ? params.threads : 1;
+
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> entries;
+    listContigBarcodes(validEnds, numContigs, offsets, entries);
+
+    /* Sketch the barcodes of each contig end */
+    std::vector<uint32_t> sketches(numEnds * k);
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 64)
+    for (size_t c = 0; c < numContigs; ++c) {
+        uint32_t* head = &sketches[ARCS::contigEnd(c, true) * k];
+        uint32_t* tail = &sketches[ARCS::contigEnd(c, false) * k];
+        clearSketch(head, k);
+        clearSketch(tail, k);
+        for (size_t j = offsets[c]; j < offsets[c + 1]; ++j)
+            addToSketch(entries[j] & 1 ? head : tail, k, entries[j] >> 1);
     }
-}
-
-/** Count barcodes. */
-static size_t countBarcodes(ARCS::IndexMap& imap, const std::unordered_map<std::string, int>& indexMultMap)
-{
-    size_t barcodeCount = 0;
-    for (auto x : indexMultMap)
-        if (x.second >= params.min_mult && x.second <= params.max_mult)
-            ++barcodeCount;
-
-    std::cout
-        << "{ \"All_barcodes_unfiltered\":" << indexMultMap.size()
-        << ", \"All_barcodes_filtered\":" << barcodeCount
-        << ", \"Scaffold_end_barcodes\":" << imap.size()
-        << ", \"Min_barcode_reads_threshold\":" << params.min_mult
-        << ", \"Max_barcode_reads_threshold\":" << params.max_mult
-        << " }\n";
-
-    return barcodeCount;
-}
 
-/* Normal approximation to the binomial distribution */
-float normalEstimation(int x, float p, int n) {
-    float mean = n * p;
-    float sd = std::sqrt(n * p * (1 - p));
-    return 0.5 * (1 + std::erf((x - mean)/(sd * std::sqrt(2))));
-}
-
-/*
- * Based on number of read pairs that align to the
- * head or tail of scaffold, determine if is significantly
- * different from a uniform distribution (p=0.5)
- */
-std::pair<bool, bool> headOrTail(int head, int tail) {
-    int max = std::max(head, tail);
-    int sum = head + tail;
-    if (sum < params.min_reads) {
-        return std::pair<bool, bool> (false, false);
+    /* Find the contig pairs whose ends share the key of a band */
+    size_t skipped = 0;
+    std::vector<uint64_t> pairs = findCandidatePairs(sketches.data(), numEnds, k, r,
+            MAX_MINHASH_BUCKET, threads,
+            [&contigToRank](uint32_t x, uint32_t y) -> uint64_t {
+                unsigned a = ARCS::contigIndex(x), b = ARCS::contigIndex(y);
+                if (a == b)
+                    return NO_PAIR;
+                if (contigToRank[a] > contigToRank[b])
+                    std::swap(a, b);
+                return uint64_t(a) << 32 | b;
+            }, skipped);
+    std::vector<uint32_t>().swap(sketches);
+    if (params.verbose && skipped > 0)
+        std::cout << "Skipped " << skipped << " contig ends of LSH buckets larger than "
+            << MAX_MINHASH_BUCKET << std::endl;
+
+    /* Count the links of the candidates by intersecting their barcodes */
+    std::vector<ARCS::PairCounts> counts(pairs.size());
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 256)
+    for (size_t p = 0; p < pairs.size(); ++p) {
+        const unsigned a = pairs[p] >> 32, b = uint32_t(pairs[p]);
+        size_t i = offsets[a], j = offsets[b];
+        while (i < offsets[a + 1] && j < offsets[b + 1]) {
+            uint32_t x = entries[i] >> 1, y = entries[j] >> 1;
+            if (x < y) {
+                ++i;
+            } else if (y < x) {
+                ++j;
+            } else {
+                /* Head - Head, Head - Tail, Tail - Head, Tail - Tail */
+                counts[p][(entries[i] & 1 ? 0 : 2) + (entries[j] & 1 ? 0 : 1)]++;
+                ++i;
+                ++j;
+            }
+        }
     }
-    float normalCdf = normalEstimation(max, 0.5, sum);
-    if (1 - normalCdf < params.error_percent) {
-        bool isHead = (max == head);
-        return std::pair<bool, bool> (true, isHead);
-    } else {
-        return std::pair<bool, bool> (false, false);
+
+    pmap.clear();
+    for (size_t p = 0; p < pairs.size(); ++p) {
+        const ARCS::PairCounts& c = counts[p];
+        if (c[0] + c[1] + c[2] + c[3] > 0)
+            pmap.push_back(std::make_pair(ARCS::ContigPair(pairs[p] >> 32, uint32_t(pairs[p])), c));
     }
+    const ARCS::ContigPairByName byName(contigToRank);
+    std::sort(pmap.begin(), pmap.end(),
+            [&byName](const ARCS::PairMap::value_type& a, const ARCS::PairMap::value_type& b) {
+                return byName(a.first, b.first);
+            });
 }
 
 /*
@@ -507,54 +1975,29 @@ std::pair<bool, bool> headOrTail(int head, int tail) {
  * that align to the same index, store in PairMap. PairMap
  * is a map with a key of pairs of saffold names, and value
  * of number of links between the pair. (Each link is one index).
+ *
+ * The valid contig ends of each barcode are found first, and the
+ * links are then counted by the specified method. If endBarcodes is
+ * not null, the barcodes of the contig ends for distance estimates are
+ * listed in the same pass over the barcodes.
  */
-void pairContigs(ARCS::IndexMap& imap, ARCS::PairMap& pmap, std::unordered_map<std::string, int>& indexMultMap) {
-
-    /* Iterate through each index in IndexMap */
-    for(auto it = imap.begin(); it != imap.end(); ++it) {
-
-        /* Get index multiplicity from indexMultMap */
-        std::string index = it->first;
-        int indexMult = indexMultMap[index];
-
-        if (indexMult >= params.min_mult && indexMult <= params.max_mult) {
-
-           /* Iterate through all the scafNames in ScafMap */
-            for (auto o = it->second.begin(); o != it->second.end(); ++o) {
-                for (auto p = it->second.begin(); p != it->second.end(); ++p) {
-                    std::string scafA, scafB;
-                    bool scafAflag, scafBflag;
-                    std::tie (scafA, scafAflag) = o->first;
-                    std::tie (scafB, scafBflag) = p->first;
-
-                    /* Only insert into pmap if scafA < scafB to avoid duplicates */
-                    if (scafA < scafB && scafAflag && scafBflag) {
-                        bool validA, validB, scafAhead, scafBhead;
-
-                        std::tie(validA, scafAhead) = headOrTail(it->second[ScaffoldEnd(scafA, true)], it->second[ScaffoldEnd(scafA, false)]);
-                        std::tie(validB, scafBhead) = headOrTail(it->second[ScaffoldEnd(scafB, true)], it->second[ScaffoldEnd(scafB, false)]);
-
-                        if (validA && validB) {
-                            std::pair<std::string, std::string> pair (scafA, scafB);
-                            if (pmap.count(pair) == 0)
-                                pmap[pair].resize(4);
-                            // Head - Head
-                            if (scafAhead && scafBhead)
-                                pmap[pair][0]++;
-                            // Head - Tail
-                            else if (scafAhead && !scafBhead)
-                                pmap[pair][1]++;
-                            // Tail - Head
-                            else if (!scafAhead && scafBhead)
-                                pmap[pair][2]++;
-                            // Tail - Tail
-                            else if (!scafAhead && !scafBhead)
-                                pmap[pair][3]++;
-                        }
-                    }
-                }
-            }
-        }
+void pairContigs(const ARCS::IndexMap& imap, ARCS::PairMap& pmap, const ARCS::IndexMultMap& indexMultMap,
+        const ARCS::ContigToRank& contigToRank, const ARCS::ContigToLength& contigLengths,
+        ARCS::PairEngine engine, EndBarcodeList* endBarcodes = NULL) {
+
+    ARCS::ValidEnds validEnds;
+    findValidEnds(imap, indexMultMap, contigToRank, contigLengths, validEnds, endBarcodes);
+
+    switch (engine) {
+      case ARCS::PAIR_HASH:
+        pairContigsHash(validEnds, contigToRank, pmap);
+        break;
+      case ARCS::PAIR_SPGEMM:
+        pairContigsSpGEMM(validEnds, contigToRank, pmap);
+        break;
+      case ARCS::PAIR_MINHASH:
+        pairContigsMinHash(validEnds, contigToRank, pmap);
+        break;
     }
 }
 
@@ -562,7 +2005,7 @@ void pairContigs(ARCS::IndexMap& imap, ARCS::PairMap& pmap, std::unordered_map<s
  * Return the max value and its index position
  * in the vector
  */
-std::pair<unsigned, unsigned> getMaxValueAndIndex(const ARCS::PairMap::value_type::second_type& array) {
+std::pair<unsigned, unsigned> getMaxValueAndIndex(const ARCS::PairCounts& array) {
     unsigned max = 0;
     unsigned index = 0;
     for (unsigned i = 0; i < array.size(); ++i) {
@@ -582,105 +2025,142 @@ bool checkSignificance(int max, int second) {
     if (max < params.min_links) {
         return false;
     }
-    float normalCdf = normalEstimation(max, 0.5, second);
-    return (1 - normalCdf < params.error_percent);
+    return criticalValues().significant(max, second);
 }
 
 /*
- * Construct a boost graph from PairMap. Each pair represents an
- * edge in the graph. The weight of each edge is the number of links
- * between the scafNames.
- * VidVdes is a mapping of vertex descriptors to scafNames (vertex id).
+ * Return true if the orientation of a contig pair with the most links
+ * is significant, and return that orientation and its links.
  */
-void createGraph(const ARCS::PairMap& pmap, ARCS::Graph& g) {
+static bool significantOrientation(const ARCS::PairCounts& count, unsigned& max, unsigned& index) {
+    std::tie(max, index) = getMaxValueAndIndex(count);
 
-    ARCS::VidVdesMap vmap;
+    unsigned second = 0;
+    for (unsigned i = 0; i < count.size(); ++i) {
+        if (count[i] != max && count[i] > second)
+            second = count[i];
+    }
 
-    ARCS::PairMap::const_iterator it;
-    for(it = pmap.begin(); it != pmap.end(); ++it) {
-        std::string scaf1, scaf2;
-        std::tie (scaf1, scaf2) = it->first;
+    return checkSignificance(max, second);
+}
 
+/*
+ * Report the fraction of the contig pairs of the exact PairMap that
+ * are found by an approximate PairMap, of all pairs, and of the pairs
+ * that would be graph edges.
+ */
+static void reportPairRecall(const ARCS::PairMap& approx, const ARCS::PairMap& exact,
+        const ARCS::ContigToRank& contigToRank)
+{
+    const ARCS::ContigPairByName byName(contigToRank);
+    size_t found = 0, edges = 0, foundEdges = 0;
+    auto it = approx.begin();
+    for (const auto& x : exact) {
+        while (it != approx.end() && byName(it->first, x.first))
+            ++it;
+        bool isFound = it != approx.end() && it->first == x.first;
         unsigned max, index;
-        const auto& count = it->second;
-        std::tie(max, index) = getMaxValueAndIndex(count);
-
-        unsigned second = 0;
-        for (unsigned i = 0; i < count.size(); ++i) {
-            if (count[i] != max && count[i] > second)
-                second = count[i];
-        }
-
-        /* Only insert edge if orientation with max links is dominant */
-        if (checkSignificance(max, second)) {
-
-            /* If scaf1 is not a node in the graph, add it */
-            if (vmap.count(scaf1) == 0) {
-                ARCS::Graph::vertex_descriptor v = boost::add_vertex(g);
-                g[v].id = scaf1;
-                vmap[scaf1] = v;
-            }
+        bool isEdge = significantOrientation(x.second, max, index);
+        found += isFound;
+        edges += isEdge;
+        foundEdges += isFound && isEdge;
+    }
+    std::cout
+        << "{ \"MinHash_candidate_pairs\":" << approx.size()
+        << ", \"Exact_pairs\":" << exact.size()
+        << ", \"Recall_pairs\":" << (exact.empty() ? 1.0 : double(found) / exact.size())
+        << ", \"Exact_edges\":" << edges
+        << ", \"Recall_edges\":" << (edges == 0 ? 1.0 : double(foundEdges) / edges)
+        << " }\n";
+}
 
-            /* If scaf2 is not a node in the graph, add it */
-            if (vmap.count(scaf2) == 0) {
-                ARCS::Graph::vertex_descriptor v = boost::add_vertex(g);
-                g[v].id = scaf2;
-                vmap[scaf2] = v;
-            }
+/*
+ * Construct the scaffold graph from PairMap. Each pair whose
+ * orientation with the most links is dominant is an edge of the graph.
+ * The weight of each edge is the number of links between the contigs.
+ */
+void createGraph(const ARCS::PairMap& pmap, ARCS::Graph& g) {
 
-            ARCS::Graph::edge_descriptor e;
-            bool inserted;
+    std::vector<ARCS::ContigLink> links;
+    for (const auto& pair : pmap) {
+        unsigned max, index;
 
-            /* Add the edge representing the pair */
-            std::tie (e, inserted) = boost::add_edge(vmap[scaf1], vmap[scaf2], g);
-            if (inserted) {
-                g[e].weight = max;
-                g[e].orientation = index;
-            }
-        }
+        /* Only insert edge if orientation with max links is dominant */
+        if (significantOrientation(pair.second, max, index))
+            links.push_back(ARCS::ContigLink{
+                    pair.first.first, pair.first.second, int(index), int(max) });
     }
+    g.build(links);
 }
 
 /*
- * Write out the boost graph in a .dot file.
+ * Write out the scaffold graph in a .dot file, in the format of
+ * boost::write_graphviz. Blocks of vertices and edges are formatted
+ * in parallel.
  */
-void writeGraph(const std::string& graphFile_dot, ARCS::Graph& g)
+void writeGraph(const std::string& graphFile_dot, const ARCS::Graph& g)
 {
     assert(!graphFile_dot.empty());
 
-	std::ofstream out(graphFile_dot.c_str());
-	assert(out);
+    ARCS::ContigToName names;
+    ARCS::listContigNames(names);
 
-	ARCS::VertexPropertyWriter<ARCS::Graph> vpWriter(g);
-	ARCS::EdgePropertyWriter<ARCS::Graph> epWriter(g);
+    std::ofstream out(graphFile_dot.c_str());
+    assert_good(out, graphFile_dot);
 
-	boost::write_graphviz(out, g, vpWriter, epWriter);
-	assert(out);
-	out.close();
+    out << "graph G {\n";
+    writeBlocks(out, g.numVertices(), params.threads,
+            [&](OutputBuffer& buf, size_t v) {
+                buf << v << " [id=" << names[g.id(v)] << "];\n";
+            });
+    writeBlocks(out, g.numEdges(), params.threads,
+            [&](OutputBuffer& buf, size_t e) {
+                buf << g.source(e) << "--" << g.target(e)
+                    << " [label=" << g.orientation(e) << ", "
+                    << "weight=" << g.weight(e);
+                if (g.hasDistance(e)) {
+                    assert(g.dist(e) != std::numeric_limits<int>::max());
+                    assert(g.maxDist(e) != std::numeric_limits<int>::max());
+                    assert(g.jaccard(e) >= 0.0f);
+                    buf << ", "
+                        << "d=" << g.dist(e) << ", "
+                        << "maxd=" << g.maxDist(e);
+                }
+                buf << "];\n";
+            });
+    out << "}\n";
+    assert_good(out, graphFile_dot);
+    out.close();
 }
 
 /*
  * Remove all nodes from graph wich have a degree
- * greater than max_degree
+ * greater than max_degree. The nodes are marked in one pass over
+ * their degrees and removed together with their edges.
+ * With -v, report the number of nodes and edges removed, and with
+ * -vv, the degree of each node removed.
  */
 void removeDegreeNodes(ARCS::Graph& g, int max_degree) {
 
-    boost::graph_traits<ARCS::Graph>::vertex_iterator vi, vi_end, next;
-    boost::tie(vi, vi_end) = boost::vertices(g);
-
-    std::vector<ARCS::VertexDes> dVertex;
-    for (next = vi; vi != vi_end; vi = next) {
-        ++next;
-        if (static_cast<int>(boost::degree(*vi, g)) > max_degree) {
-            dVertex.push_back(*vi);
-        }
+    const size_t numVertices = g.numVertices();
+    const size_t numEdges = g.numEdges();
+    std::vector<bool> remove(numVertices);
+    size_t removed = 0;
+    for (ARCS::Graph::V v = 0; v < numVertices; ++v) {
+        if (static_cast<int>(g.degree(v)) <= max_degree)
+            continue;
+        remove[v] = true;
+        ++removed;
+        if (params.verbose > 1)
+            std::cout << "      Removing " << g_contigNames.getName(g.id(v))
+                << " with degree " << g.degree(v) << '\n';
     }
+    g.removeVertices(remove);
 
-    for (unsigned i = 0; i < dVertex.size(); i++) {
-        boost::clear_vertex(dVertex[i], g);
-        boost::remove_vertex(dVertex[i], g);
-    }
-    boost::renumber_indices(g);
+    if (params.verbose)
+        std::cout << "      Removed " << removed << " of " << numVertices
+            << " nodes and " << numEdges - g.numEdges() << " of " << numEdges
+            << " edges\n";
 }
 
 /*
@@ -702,35 +2182,35 @@ void writePostRemovalGraph(ARCS::Graph& g, const std::string graphFile) {
 }
 
 /*
- * Construct an ABySS distance estimate graph from a boost graph.
+ * Construct an ABySS distance estimate graph from the scaffold graph.
+ * The vertices of the ABySS graph are numbered as g_contigNames.
  */
-void createAbyssGraph(const ARCS::ScaffSizeList& scaffSizes, const ARCS::Graph& gin, DistGraph& gout) {
+void createAbyssGraph(const ARCS::ContigToLength& contigLengths, const ARCS::Graph& gin, DistGraph& gout) {
     // Add the vertices.
-    for (const auto& it : scaffSizes) {
+    for (const auto& length : contigLengths) {
         vertex_property<DistGraph>::type vp;
-        vp.length = it.second;
-        const auto u = add_vertex(vp, gout);
-        put(vertex_name, gout, u, it.first);
+        vp.length = length;
+        add_vertex(vp, gout);
     }
 
     // Add the edges.
-    for (const auto ein : boost::make_iterator_range(boost::edges(gin))) {
-        const auto einp = gin[ein];
-        const auto u = find_vertex(gin[source(ein, gin)].id, einp.orientation < 2, gout);
-        const auto v = find_vertex(gin[target(ein, gin)].id, einp.orientation % 2, gout);
+    for (ARCS::Graph::E ein = 0; ein < gin.numEdges(); ++ein) {
+        const int orientation = gin.orientation(ein);
+        const ContigNode u(gin.id(gin.source(ein)), orientation < 2);
+        const ContigNode v(gin.id(gin.target(ein)), orientation % 2);
 
         edge_property<DistGraph>::type ep;
         ep.distance = params.gap;
         ep.stdDev = params.gap;
-        ep.numPairs = einp.weight;
+        ep.numPairs = gin.weight(ein);
 
         /* use distance estimates, if enabled */
         if (params.dist_est) {
             if (params.dist_mode == ARCS::DIST_MEDIAN) {
-                ep.distance = einp.dist;
+                ep.distance = gin.dist(ein);
             } else {
                 assert(params.dist_mode == ARCS::DIST_UPPER);
-                ep.distance = einp.maxDist;
+                ep.distance = gin.maxDist(ein);
             }
         }
 
@@ -751,7 +2231,10 @@ void createAbyssGraph(const ARCS::ScaffSizeList& scaffSizes, const ARCS::Graph&
  */
 void writeAbyssGraph(const std::string& path, const DistGraph& g) {
     assert(!path.empty());
-    ofstream out(path.c_str());
+    std::vector<char> buffer(OutputBuffer::CAPACITY);
+    ofstream out;
+    out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    out.open(path.c_str());
     assert_good(out, path);
     write_dot(out, g, "arcs");
     assert_good(out, path);
@@ -763,13 +2246,16 @@ void writeAbyssGraph(const std::string& path, const DistGraph& g) {
  */
 void writeBarcodeCountsTSV(
         const std::string& tsvFile,
-        const std::unordered_map<std::string, int>& indexMultMap)
+        const ARCS::IndexMultMap& indexMultMap)
 {
     assert(!tsvFile.empty());
 
     // Sort the barcodes by their counts and then their sequence.
     typedef std::vector<std::pair<std::string, unsigned>> Sorted;
-    Sorted sorted(indexMultMap.begin(), indexMultMap.end());
+    Sorted sorted;
+    sorted.reserve(indexMultMap.size());
+    for (const auto& x : indexMultMap)
+        sorted.push_back(Sorted::value_type(g_barcodes.decode(x.first), x.second));
     sort(sorted.begin(), sorted.end(),
             [](const Sorted::value_type& a, const Sorted::value_type& b) {
                 return a.second != b.second ? a.second > b.second : a.first < b.first;
@@ -779,8 +2265,10 @@ void writeBarcodeCountsTSV(
     assert_good(f, tsvFile);
     f << "Barcode\tReads\n";
     assert_good(f, tsvFile);
-    for (auto x : sorted)
-        f << x.first << '\t' << x.second << '\n';
+    writeBlocks(f, sorted.size(), params.threads,
+            [&](OutputBuffer& buf, size_t i) {
+                buf << sorted[i].first << '\t' << sorted[i].second << '\n';
+            });
     assert_good(f, tsvFile);
 }
 
@@ -790,59 +2278,56 @@ void writeBarcodeCountsTSV(
  * - CountU: the number of barcodes on scaffold end U
  * - CountV: the number of barcodes on scaffold end V
  * - CountAll: the total number of barcodes observed
+ * The number of barcodes of each scaffold end is given by countEndBarcodes.
  */
 void writeTSV(
         const std::string& tsvFile,
-        const ARCS::IndexMap& imap,
+        const std::vector<unsigned>& barcodes_per_scaffold_end,
         const ARCS::PairMap& pmap,
         size_t barcodeCount)
 {
     assert(!tsvFile.empty());
+    assert(barcodes_per_scaffold_end.size() == 2 * g_contigNames.size());
 
-    // Count the number of barcodes seen per scaffold end.
-    std::unordered_map<ScaffoldEnd, unsigned, HashScaffoldEnd> barcodes_per_scaffold_end;
-    for (const auto& it : imap) {
-        for (const auto& scaffold_count : it.second) {
-            const auto& scaffold = scaffold_count.first;
-            const auto& count = scaffold_count.second;
-            if (count >= params.min_reads)
-               ++barcodes_per_scaffold_end[scaffold];
-        }
-    }
+    ARCS::ContigToName names;
+    ARCS::listContigNames(names);
 
     std::ofstream f(tsvFile);
     assert_good(f, tsvFile);
     f << "U\tV\tBest_orientation\tShared_barcodes\tU_barcodes\tV_barcodes\tAll_barcodes\n";
     assert_good(f, tsvFile);
-    for (const auto& it : pmap) {
-        const auto& u = it.first.first;
-        const auto& v = it.first.second;
-        const auto& counts = it.second;
-        assert(!counts.empty());
-        unsigned max_counts = *std::max_element(counts.begin(), counts.end());
-        for (unsigned i = 0; i < counts.size(); ++i) {
-            if (counts[i] == 0)
-                continue;
-            bool usense = i < 2;
-            bool vsense = i % 2;
-            f << u << (usense ? '-' : '+')
-                << '\t' << v << (vsense ? '-' : '+')
-                << '\t' << (counts[i] == max_counts ? "T" : "F")
-                << '\t' << counts[i]
-                << '\t' << barcodes_per_scaffold_end[std::make_pair(u, usense)]
-                << '\t' << barcodes_per_scaffold_end[std::make_pair(v, !vsense)]
-                << '\t' << barcodeCount
-                << '\n';
-            f << v << (vsense ? '+' : '-')
-                << '\t' << u << (usense ? '+' : '-')
-                << '\t' << (counts[i] == max_counts ? "T" : "F")
-                << '\t' << counts[i]
-                << '\t' << barcodes_per_scaffold_end[std::make_pair(v, !vsense)]
-                << '\t' << barcodes_per_scaffold_end[std::make_pair(u, usense)]
-                << '\t' << barcodeCount
-                << '\n';
-        }
-    }
+    writeBlocks(f, pmap.size(), params.threads,
+            [&](OutputBuffer& buf, size_t p) {
+                const unsigned uIndex = pmap[p].first.first;
+                const unsigned vIndex = pmap[p].first.second;
+                const StringRef& u = names[uIndex];
+                const StringRef& v = names[vIndex];
+                const auto& counts = pmap[p].second;
+                assert(!counts.empty());
+                unsigned max_counts = *std::max_element(counts.begin(), counts.end());
+                for (unsigned i = 0; i < counts.size(); ++i) {
+                    if (counts[i] == 0)
+                        continue;
+                    bool usense = i < 2;
+                    bool vsense = i % 2;
+                    buf << u << (usense ? '-' : '+')
+                        << '\t' << v << (vsense ? '-' : '+')
+                        << '\t' << (counts[i] == max_counts ? "T" : "F")
+                        << '\t' << counts[i]
+                        << '\t' << barcodes_per_scaffold_end[ARCS::contigEnd(uIndex, usense)]
+                        << '\t' << barcodes_per_scaffold_end[ARCS::contigEnd(vIndex, !vsense)]
+                        << '\t' << barcodeCount
+                        << '\n';
+                    buf << v << (vsense ? '+' : '-')
+                        << '\t' << u << (usense ? '+' : '-')
+                        << '\t' << (counts[i] == max_counts ? "T" : "F")
+                        << '\t' << counts[i]
+                        << '\t' << barcodes_per_scaffold_end[ARCS::contigEnd(vIndex, !vsense)]
+                        << '\t' << barcodes_per_scaffold_end[ARCS::contigEnd(uIndex, usense)]
+                        << '\t' << barcodeCount
+                        << '\n';
+                }
+            });
     assert_good(f, tsvFile);
 }
 
@@ -857,8 +2342,7 @@ static const char* maybeNA(const std::string& s)
  * barcodes between contig ends
  */
 static inline void calcDistanceEstimates(
-    const ARCS::IndexMap& imap,
-    const std::unordered_map<std::string, int> &indexMultMap,
+    const EndToBarcodes& endToBarcodes,
     const ARCS::ContigToLength& contigToLength,
     ARCS::Graph& g)
 {
@@ -868,7 +2352,7 @@ static inline void calcDistanceEstimates(
     std::cout << "\n\t=> Measuring intra-contig distances / shared barcodes... "
         << ctime(&rawtime);
     DistSampleMap distSamples;
-    calcDistSamples(imap, contigToLength, indexMultMap, params, distSamples);
+    calcDistSamples(endToBarcodes, contigToLength, params, distSamples);
 
     time(&rawtime);
     std::cout << "\n\t=> Writing intra-contig distance samples to TSV... "
@@ -879,23 +2363,26 @@ static inline void calcDistanceEstimates(
     std::cout << "\n\t=> Building Jaccard to distance map... "
         << ctime(&rawtime);
     JaccardToDist jaccardToDist;
-    buildJaccardToDist(distSamples, jaccardToDist);
+    buildJaccardToDist(distSamples, params, jaccardToDist);
 
     time(&rawtime);
-    std::cout << "\n\t=> Calculating barcode stats for scaffold pairs... "
+    std::cout << "\n\t=> Calculating barcode stats for graph edges... "
         << ctime(&rawtime);
+    const unsigned threads = params.threads > 0 ? params.threads : 1;
     PairToBarcodeStats pairToStats;
-    buildPairToBarcodeStats(imap, indexMultMap, contigToLength, params, pairToStats);
+    buildPairToBarcodeStats(endToBarcodes, g, pairToStats);
+    EdgeStatsList edgeStats;
+    listEdgeStats(pairToStats, g, threads, edgeStats);
 
     time(&rawtime);
     std::cout << "\n\t=> Adding edge distances... " << ctime(&rawtime);
-    addEdgeDistances(pairToStats, jaccardToDist, params, g);
+    addEdgeDistances(edgeStats, jaccardToDist, threads, g);
 
     if (!params.dist_tsv.empty()) {
         time(&rawtime);
         std::cout << "\n\t=> Writing distance estimates to TSV... "
             << ctime(&rawtime);
-        writeDistTSV(params.dist_tsv, pairToStats, g);
+        writeDistTSV(params.dist_tsv, edgeStats, g, threads);
     }
 }
 
@@ -912,9 +2399,18 @@ void runArcs(const std::vector<std::string>& filenames) {
         << "\n -m " << params.min_mult << '-' << params.max_mult
         << "\n -r " << params.error_percent
         << "\n -s " << params.seq_id
+        << "\n -t " << params.threads
         << "\n -v " << params.verbose
         << "\n -z " << params.min_size
         << "\n --gap=" << params.gap
+        << "\n --pair_" << (params.pair_engine == ARCS::PAIR_SPGEMM ? "spgemm"
+                : params.pair_engine == ARCS::PAIR_MINHASH ? "minhash" : "hash")
+        << "\n --sketch_size=" << params.sketch_size
+        << "\n --sketch_bands=" << params.sketch_bands
+        << "\n --barcode-sorted=" << params.barcode_sorted
+        << "\n --unsorted=" << params.unsorted
+        << "\n --mate_buffer=" << params.mate_buffer
+        << "\n --prefilter=" << params.prefilter
         // Output files
         << "\n -b " << maybeNA(params.base_name)
         << "\n -g " << maybeNA(params.dist_graph_name)
@@ -928,29 +2424,55 @@ void runArcs(const std::vector<std::string>& filenames) {
         std::cout << ' ' << filename << '\n';
     std::cout.flush();
 
+    /* Build the table of critical values before any parallel use */
+    criticalValues();
+
     ARCS::IndexMap imap;
-    ARCS::PairMap pmap;
     ARCS::Graph g;
 
     std::time_t rawtime;
 
-    ARCS::ScaffSizeList scaffSizeList;
-    ARCS::ScaffSizeMap scaffSizeMap;
+    ARCS::ContigToLength contigLengths;
     if (!params.file.empty()) {
         time(&rawtime);
         std::cout << "\n=> Getting scaffold sizes... " << ctime(&rawtime);
-        getScaffSizes(params.file, scaffSizeList);
-        scaffSizeMap.insert(scaffSizeList.begin(), scaffSizeList.end());
+        getScaffSizes(params.file, contigLengths);
     }
 
-    std::unordered_map<std::string, int> indexMultMap;
+    ARCS::IndexMultMap indexMultMap;
     time(&rawtime);
     std::cout << "\n=> Reading alignment files... " << ctime(&rawtime);
     std::vector<std::string> bamFiles = readFof(params.fofName);
     std::copy(filenames.begin(), filenames.end(), std::back_inserter(bamFiles));
-    readBAMS(bamFiles, imap, indexMultMap, scaffSizeList, scaffSizeMap);
+    if (params.prefilter) {
+        time(&rawtime);
+        std::cout << "\n=> Counting the reads of each barcode... " << ctime(&rawtime);
+        for (const auto& bamName : bamFiles)
+            countBarcodeReads(bamName, g_prefilterMult);
+        if (params.verbose) {
+            size_t n = std::count_if(g_prefilterMult.begin(), g_prefilterMult.end(),
+                    [](const ARCS::IndexMultMap::value_type& x) { return passPrefilter(x.first); });
+            std::cout << "Prefilter: " << n << " of " << g_prefilterMult.size()
+                << " barcodes are in the multiplicity range" << std::endl;
+        }
+    }
 
-    size_t barcodeCount = countBarcodes(imap, indexMultMap);
+    BarcodeStream stream(contigLengths);
+    if (params.barcode_sorted)
+        readBarcodeSorted(bamFiles, stream, contigLengths);
+    else
+        readBAMS(bamFiles, imap, indexMultMap, contigLengths);
+    if (params.prefilter)
+        std::swap(indexMultMap, g_prefilterMult);
+    ARCS::ContigToRank contigToRank = rankContigNames();
+
+    size_t barcodeCount;
+    if (params.barcode_sorted) {
+        reportBarcodeCounts(stream.numBarcodes, stream.numFiltered, stream.numEndBarcodes);
+        barcodeCount = stream.numFiltered;
+        std::swap(indexMultMap, stream.indexMultMap);
+    } else
+        barcodeCount = countBarcodes(imap, indexMultMap);
 
     if (!params.barcode_counts_name.empty()) {
         time(&rawtime);
@@ -960,7 +2482,22 @@ void runArcs(const std::vector<std::string>& filenames) {
 
     time(&rawtime);
     std::cout << "\n=> Pairing scaffolds... " << ctime(&rawtime);
-    pairContigs(imap, pmap, indexMultMap);
+    ARCS::PairMap pmap;
+    EndBarcodeList endBarcodes;
+    if (params.barcode_sorted) {
+        mergeLinks(stream.tables, contigToRank, pmap);
+        endBarcodes.swap(stream.endBarcodes);
+    } else
+        pairContigs(imap, pmap, indexMultMap, contigToRank, contigLengths, params.pair_engine,
+                params.dist_est ? &endBarcodes : NULL);
+
+    if (params.pair_engine == ARCS::PAIR_MINHASH && params.verbose) {
+        time(&rawtime);
+        std::cout << "\n=> Measuring the recall of MinHash pairing... " << ctime(&rawtime);
+        ARCS::PairMap exact;
+        pairContigs(imap, exact, indexMultMap, contigToRank, contigLengths, ARCS::PAIR_HASH);
+        reportPairRecall(pmap, exact, contigToRank);
+    }
 
     time(&rawtime);
     std::cout << "\n=> Creating the graph... " << ctime(&rawtime);
@@ -968,7 +2505,15 @@ void runArcs(const std::vector<std::string>& filenames) {
 
     if (params.dist_est) {
         std::cout << "\n=> Calculating distance estimates... " << ctime(&rawtime);
-        calcDistanceEstimates(imap, indexMultMap, scaffSizeMap, g);
+
+        time(&rawtime);
+        std::cout << "\n\t=> Listing the barcodes of contig ends... "
+            << ctime(&rawtime);
+        EndToBarcodes endToBarcodes;
+        buildEndToBarcodes(endBarcodes, 2 * contigLengths.size(), endToBarcodes);
+        EndBarcodeList().swap(endBarcodes);
+
+        calcDistanceEstimates(endToBarcodes, contigLengths, g);
     }
 
     if (!params.base_name.empty()) {
@@ -982,7 +2527,7 @@ void runArcs(const std::vector<std::string>& filenames) {
         time(&rawtime);
         std::cout << "\n=> Creating the ABySS graph... " << ctime(&rawtime);
         DistGraph gdist;
-        createAbyssGraph(scaffSizeList, g, gdist);
+        createAbyssGraph(contigLengths, g, gdist);
 
         time(&rawtime);
         std::cout << "\n=> Writing the ABySS graph file... " << ctime(&rawtime) << "\n";
@@ -992,7 +2537,13 @@ void runArcs(const std::vector<std::string>& filenames) {
     if (!params.tsv_name.empty()) {
         time(&rawtime);
         std::cout << "\n=> Writing TSV file... " << ctime(&rawtime) << "\n";
-        writeTSV(params.tsv_name, imap, pmap, barcodeCount);
+        std::vector<unsigned> barcodesPerEnd;
+        if (params.barcode_sorted) {
+            barcodesPerEnd.swap(stream.barcodesPerEnd);
+            barcodesPerEnd.resize(2 * g_contigNames.size());
+        } else
+            countEndBarcodes(imap, barcodesPerEnd);
+        writeTSV(params.tsv_name, barcodesPerEnd, pmap, barcodeCount);
     }
 
     time(&rawtime);
@@ -1015,6 +2566,8 @@ int main(int argc, char** argv) {
                 arg >> params.dist_bin_size; break;
             case 's':
                 arg >> params.seq_id; break;
+            case 't':
+                arg >> params.threads; break;
             case 'c':
                 arg >> params.min_reads; break;
             case 'D':
@@ -1043,6 +2596,24 @@ int main(int argc, char** argv) {
                 params.dist_mode = ARCS::DIST_MEDIAN; break;
             case OPT_DIST_UPPER:
                 params.dist_mode = ARCS::DIST_UPPER; break;
+            case OPT_PAIR_HASH:
+                params.pair_engine = ARCS::PAIR_HASH; break;
+            case OPT_PAIR_SPGEMM:
+                params.pair_engine = ARCS::PAIR_SPGEMM; break;
+            case OPT_PAIR_MINHASH:
+                params.pair_engine = ARCS::PAIR_MINHASH; break;
+            case OPT_SKETCH_SIZE:
+                arg >> params.sketch_size; break;
+            case OPT_SKETCH_BANDS:
+                arg >> params.sketch_bands; break;
+            case OPT_BARCODE_SORTED:
+                params.barcode_sorted = true; break;
+            case OPT_UNSORTED:
+                params.unsorted = true; break;
+            case OPT_MATE_BUFFER:
+                arg >> params.mate_buffer; break;
+            case OPT_PREFILTER:
+                params.prefilter = true; break;
             case 'm': {
                 std::string firstStr, secondStr;
                 std::getline(arg, firstStr, '-');
@@ -1098,6 +2669,27 @@ int main(int argc, char** argv) {
         die = true;
     }
 
+    if (params.sketch_size == 0 || params.sketch_bands == 0
+            || params.sketch_size % params.sketch_bands != 0) {
+        cerr << PROGRAM ": error: --sketch_bands must divide --sketch_size\n";
+        die = true;
+    }
+
+    if (params.barcode_sorted && params.pair_engine != ARCS::PAIR_HASH) {
+        cerr << PROGRAM ": error: --barcode-sorted counts links with --pair_hash\n";
+        die = true;
+    }
+
+    if (params.barcode_sorted && params.unsorted) {
+        cerr << PROGRAM ": error: --barcode-sorted and --unsorted are incompatible\n";
+        die = true;
+    }
+
+    if (params.barcode_sorted && params.prefilter) {
+        cerr << PROGRAM ": error: --barcode-sorted and --prefilter are incompatible\n";
+        die = true;
+    }
+
     std::vector<std::string> filenames(argv + optind, argv + argc);
     if (params.fofName.empty() && filenames.empty()) {
         cerr << PROGRAM ": error: specify input SAM/BAM file(s) or a list of files with -a option\n";
@@ -8,6 +8,8 @@
 #include <iostream>
 #include <utility>
 #include <algorithm>
+#include <array>
+#include <cassert>
 #include <cmath>
 #include <map>
 #include <unordered_map>
@@ -16,12 +18,14 @@
 #include <utility>
 #include <vector>
 #include <iterator>
+#include <limits>
 #include <time.h>
-#include <boost/graph/undirected_graph.hpp>
-#include <boost/graph/graphviz.hpp>
+#include "Common/Barcode.h"
 #include "Common/Uncompress.h"
 #include "DataLayer/FastaReader.h"
 #include "DataLayer/FastaReader.cpp"
+#include "Common/ContigID.h"
+#include "Common/StringUtil.h"
 
 
 namespace ARCS {
@@ -29,6 +33,9 @@ namespace ARCS {
     /** value to use for 'd' in ABySS dist.gv */
     enum DistMode { DIST_MEDIAN=0, DIST_UPPER };
 
+    /** method used to count the links between contigs */
+    enum PairEngine { PAIR_HASH=0, PAIR_SPGEMM, PAIR_MINHASH };
+
     /**
      * Parameters controlling ARCS run
      */
@@ -38,6 +45,8 @@ namespace ARCS {
         std::string file;
         std::string fofName;
         int seq_id;
+        /** number of threads */
+        unsigned threads;
         int min_reads;
         /** enable/disable distance estimation on graph edges */
         bool dist_est;
@@ -49,6 +58,20 @@ namespace ARCS {
         std::string dist_tsv;
         /** chooses median or upper bound for `d` in ABySS dist.gv */
         DistMode dist_mode;
+        /** chooses the method used to count links in pairContigs */
+        PairEngine pair_engine;
+        /** number of MinHash values per contig end for PAIR_MINHASH */
+        unsigned sketch_size;
+        /** number of LSH bands of the MinHash sketches */
+        unsigned sketch_bands;
+        /** alignments are grouped by barcode and paired as they are read */
+        bool barcode_sorted;
+        /** alignments are in any order, and mates are paired by read name */
+        bool unsorted;
+        /** max number of reads awaiting their mates in memory, for unsorted */
+        size_t mate_buffer;
+        /** count the reads per barcode in a first pass over the alignments */
+        bool prefilter;
         int min_links;
         int min_size;
         std::string base_name;
@@ -66,10 +89,18 @@ namespace ARCS {
         ArcsParams() :
             bx(false),
             seq_id(98),
+            threads(1),
             min_reads(5),
             dist_est(false),
             dist_bin_size(20),
             dist_mode(DIST_MEDIAN),
+            pair_engine(PAIR_HASH),
+            sketch_size(64),
+            sketch_bands(32),
+            barcode_sorted(false),
+            unsorted(false),
+            mate_buffer(1000000),
+            prefilter(false),
             min_links(0),
             min_size(500),
             gap(100),
@@ -83,104 +114,483 @@ namespace ARCS {
 
     };
 
-    /* ScafMap: <pair(scaffold id, bool), count>, cout =  # times index maps to scaffold (c), bool = true-head, false-tail*/
-    typedef std::map<std::pair<std::string, bool>, int> ScafMap;
-    typedef typename ScafMap::const_iterator ScafMapConstIt;
-    /* IndexMap: key = index sequence, value = ScafMap */
-    typedef std::unordered_map<std::string, ScafMap> IndexMap;
-    /* PairMap: key = pair(first < second) of scaf sequence id, value = num links*/
-    typedef std::map<std::pair<std::string, std::string>, std::vector<unsigned>> PairMap;
+    /**
+     * A contig end: the index of the contig in g_contigNames,
+     * shifted left by one, and one for the head or zero for the tail
+     */
+    typedef uint32_t CI;
+
+    /** Return the head or tail of a contig. */
+    static inline CI contigEnd(unsigned contig, bool head)
+    {
+        return CI(contig) << 1 | head;
+    }
+
+    /** Return the index of the contig of a contig end. */
+    static inline unsigned contigIndex(CI end)
+    {
+        return end >> 1;
+    }
+
+    /** Return true if the contig end is the head. */
+    static inline bool isHead(CI end)
+    {
+        return end & 1;
+    }
+
+    /* ScafCount: <contig end, count>, count = # times index maps to the contig end */
+    typedef std::pair<CI, int> ScafCount;
+
+    /** Compare ScafCount by contig end. */
+    static inline bool compareContigEnds(const ScafCount& a, const ScafCount& b)
+    {
+        return a.first < b.first;
+    }
+
+    /*
+     * ScafMap: the contig ends of one barcode, sorted by contig end, so
+     * that the head and tail of a contig are adjacent. A contig end to
+     * which no read pair of the barcode aligns is not present.
+     */
+    class ScafMap {
+      public:
+        typedef const ScafCount* const_iterator;
+
+        ScafMap(const_iterator first, const_iterator last)
+            : m_first(first), m_last(last) {}
+
+        const_iterator begin() const { return m_first; }
+        const_iterator end() const { return m_last; }
+        size_t size() const { return m_last - m_first; }
+
+        /** Return the specified contig end, or end() if it is not present. */
+        const_iterator find(CI key) const
+        {
+            const_iterator it = std::lower_bound(m_first, m_last,
+                    ScafCount(key, 0), compareContigEnds);
+            return it != m_last && it->first == key ? it : m_last;
+        }
+
+      private:
+        const_iterator m_first, m_last;
+    };
+    typedef ScafMap::const_iterator ScafMapConstIt;
+
+    /*
+     * IndexMap: key = index sequence, value = ScafMap. The barcodes are
+     * numbered from 0, and the contig ends of all the barcodes are
+     * stored in one array.
+     */
+    class IndexMap {
+      public:
+        IndexMap() : m_offsets(1, 0) {}
+
+        /** Return the number of barcodes. */
+        size_t size() const { return m_barcodes.size(); }
+        bool empty() const { return m_barcodes.empty(); }
+
+        /** Return the barcode i. */
+        BarcodeKey barcode(size_t i) const { return m_barcodes[i]; }
+
+        /** Return the contig ends of barcode i. */
+        ScafMap operator[](size_t i) const
+        {
+            return ScafMap(m_ends.data() + m_offsets[i],
+                    m_ends.data() + m_offsets[i + 1]);
+        }
+
+        /** Reserve space for the specified number of contig ends. */
+        void reserve(size_t barcodes, size_t ends)
+        {
+            m_barcodes.reserve(barcodes);
+            m_offsets.reserve(barcodes + 1);
+            m_ends.reserve(ends);
+        }
+
+        /** Add a barcode and its contig ends, sorted by contig end. */
+        void push_back(BarcodeKey barcode, const std::vector<ScafCount>& ends)
+        {
+            assert(std::is_sorted(ends.begin(), ends.end(), compareContigEnds));
+            m_barcodes.push_back(barcode);
+            m_ends.insert(m_ends.end(), ends.begin(), ends.end());
+            m_offsets.push_back(m_ends.size());
+        }
+
+        void swap(IndexMap& o)
+        {
+            m_barcodes.swap(o.m_barcodes);
+            m_offsets.swap(o.m_offsets);
+            m_ends.swap(o.m_ends);
+        }
+
+      private:
+        std::vector<BarcodeKey> m_barcodes;
+        std::vector<size_t> m_offsets;
+        std::vector<ScafCount> m_ends;
+    };
+
+    /*
+     * ValidEnds: for each barcode of an IndexMap, the contig ends that
+     * pass the head or tail test of pairContigs, at most one per contig,
+     * sorted by the FASTA IDs of the contigs.
+     */
+    class ValidEnds {
+      public:
+        typedef const CI* const_iterator;
 
-    /** A contig end: (FASTA ID, head?) */
-    typedef std::pair<std::string, bool> CI;
+        ValidEnds() : m_offsets(1, 0) {}
 
-    /** a pair of contig IDs */
-    typedef std::pair<std::string, std::string> ContigPair;
+        /** Return the number of barcodes. */
+        size_t size() const { return m_offsets.size() - 1; }
+
+        /** Return the valid contig ends of barcode i. */
+        const_iterator begin(size_t i) const { return m_ends.data() + m_offsets[i]; }
+        const_iterator end(size_t i) const { return m_ends.data() + m_offsets[i + 1]; }
+        size_t size(size_t i) const { return m_offsets[i + 1] - m_offsets[i]; }
+
+        /** Add the valid contig ends of the next barcode. */
+        void push_back(const std::vector<CI>& ends)
+        {
+            m_ends.insert(m_ends.end(), ends.begin(), ends.end());
+            m_offsets.push_back(m_ends.size());
+        }
+
+        /** Add the barcodes of another ValidEnds. */
+        void append(const ValidEnds& o)
+        {
+            size_t base = m_ends.size();
+            m_ends.insert(m_ends.end(), o.m_ends.begin(), o.m_ends.end());
+            for (size_t i = 1; i < o.m_offsets.size(); ++i)
+                m_offsets.push_back(base + o.m_offsets[i]);
+        }
+
+      private:
+        std::vector<size_t> m_offsets;
+        std::vector<CI> m_ends;
+    };
+
+    /* IndexMultMap: key = index sequence, value = number of reads */
+    typedef std::unordered_map<BarcodeKey, int, HashBarcode> IndexMultMap;
+    /** a pair of contig indices */
+    typedef std::pair<unsigned, unsigned> ContigPair;
 
     /**
-     * a list of the input scaffolds and their lengths, in the order
-     * that they appear in the input contigs FASTA file
+     * maps contig index to contig length (bp). The contigs are
+     * numbered in the order that they appear in the input contigs
+     * FASTA file or SAM header, and their names are in g_contigNames.
      */
-    typedef std::vector< std::pair<std::string, int> > ScaffSizeList;
+    typedef std::vector<int> ContigToLength;
+
+    /** maps contig index to the rank of its FASTA ID in sorted order */
+    typedef std::vector<unsigned> ContigToRank;
+
+    /** maps contig index to its name in g_contigNames, for output */
+    typedef std::vector<StringRef> ContigToName;
+
+    /** List the names of the contigs in g_contigNames. */
+    static inline void listContigNames(ContigToName& names)
+    {
+        names.resize(g_contigNames.size());
+        for (size_t i = 0; i < names.size(); ++i) {
+            cstring name = g_contigNames.getName(i);
+            names[i] = StringRef(name.c_str(), name.size());
+        }
+    }
+
+    /** Order pairs of contigs by their FASTA IDs. */
+    struct ContigPairByName {
+        const ContigToRank* rank;
+
+        ContigPairByName(const ContigToRank& rank) : rank(&rank) {}
+
+        bool operator()(const ContigPair& a, const ContigPair& b) const
+        {
+            const ContigToRank& r = *rank;
+            return r[a.first] != r[b.first] ? r[a.first] < r[b.first]
+                : r[a.second] < r[b.second];
+        }
+    };
+
+    /** The number of links of each orientation: 0-HH, 1-HT, 2-TH, 3-TT */
+    typedef std::array<uint32_t, 4> PairCounts;
+
+    /*
+     * PairMap: key = pair(first < second by FASTA ID) of contig indices,
+     * value = num links. The pairs are sorted by ContigPairByName.
+     */
+    typedef std::vector<std::pair<ContigPair, PairCounts>> PairMap;
 
     /**
-     * a list of the input scaffolds and their lengths, in the order
-     * that they appear in the input contigs FASTA file
+     * PairTable: an open-addressing hash table of contig pairs, which
+     * counts their links. A pair is stored as a 64-bit key, and its
+     * counts are stored inline.
      */
-    typedef std::unordered_map<std::string, int> ScaffSizeMap;
+    class PairTable {
+      public:
+        PairTable() : m_size(0) {}
 
-    /** maps contig FASTA ID to contig length (bp) */
-    typedef std::unordered_map<std::string, int> ContigToLength;
-    typedef typename ContigToLength::const_iterator ContigToLengthIt;
+        /** Return the number of pairs. */
+        size_t size() const { return m_size; }
 
-    struct VertexProperties {
-        std::string id;
+        /** Return the counts of a pair, adding the pair if it is new. */
+        PairCounts& operator[](const ContigPair& pair)
+        {
+            if (2 * (m_size + 1) > m_keys.size())
+                grow();
+            uint64_t key = uint64_t(pair.first) << 32 | pair.second;
+            assert(key != EMPTY);
+            size_t i = find(key);
+            if (m_keys[i] == EMPTY) {
+                m_keys[i] = key;
+                ++m_size;
+            }
+            return m_counts[i];
+        }
+
+        /** Append the pairs and their counts to a PairMap, in no particular order. */
+        void appendTo(PairMap& pmap) const
+        {
+            pmap.reserve(pmap.size() + m_size);
+            for (size_t i = 0; i < m_keys.size(); ++i)
+                if (m_keys[i] != EMPTY)
+                    pmap.push_back(std::make_pair(ContigPair(m_keys[i] >> 32, uint32_t(m_keys[i])),
+                                m_counts[i]));
+        }
+
+        void swap(PairTable& o)
+        {
+            m_keys.swap(o.m_keys);
+            m_counts.swap(o.m_counts);
+            std::swap(m_size, o.m_size);
+        }
+
+      private:
+        static const uint64_t EMPTY = ~uint64_t(0);
+
+        /** Return the slot of the key, or the empty slot where it belongs. */
+        size_t find(uint64_t key) const
+        {
+            size_t mask = m_keys.size() - 1;
+            size_t i = HashBarcode()(key) & mask;
+            while (m_keys[i] != EMPTY && m_keys[i] != key)
+                i = (i + 1) & mask;
+            return i;
+        }
+
+        /** Double the number of slots. */
+        void grow()
+        {
+            std::vector<uint64_t> keys(m_keys.empty() ? 1024 : 2 * m_keys.size(), uint64_t(EMPTY));
+            std::vector<PairCounts> counts(keys.size());
+            keys.swap(m_keys);
+            counts.swap(m_counts);
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (keys[i] != EMPTY) {
+                    size_t j = find(keys[i]);
+                    m_keys[j] = keys[i];
+                    m_counts[j] = counts[i];
+                }
+            }
+        }
+
+        std::vector<uint64_t> m_keys;
+        std::vector<PairCounts> m_counts;
+        size_t m_size;
     };
 
-    /* Orientation: 0-HH, 1-HT, 2-TH, 3-TT */
-    struct EdgeProperties {
+    /** an edge between contigs u and v. Orientation: 0-HH, 1-HT, 2-TH, 3-TT */
+    struct ContigLink {
+        unsigned u;
+        unsigned v;
         int orientation;
         int weight;
-        int minDist;
-        int dist;
-        int maxDist;
-        float jaccard;
-        EdgeProperties() :
-            orientation(0), weight(0),
-            minDist(std::numeric_limits<int>::min()),
-            dist(std::numeric_limits<int>::max()),
-            maxDist(std::numeric_limits<int>::max()),
-            jaccard(-1.0f)
-            {}
     };
 
-    template <class GraphT>
-    struct EdgePropertyWriter
-    {
-        typedef typename boost::graph_traits<GraphT>::edge_descriptor E;
-        typedef typename boost::edge_property<GraphT>::type EP;
+    /**
+     * The scaffold graph: an undirected graph whose vertices are
+     * contigs and whose edges are links between contigs. It is built
+     * in bulk, after which only the distance estimates of its edges
+     * change. The vertices are numbered in the order of their first
+     * edge, and the edges in the order in which they were given. The
+     * edge properties are stored as arrays, and the edges of each
+     * vertex in compressed sparse row form.
+     */
+    class Graph {
+      public:
+        /** a vertex index */
+        typedef unsigned V;
+        /** an edge index */
+        typedef size_t E;
+        typedef const E* const_iterator;
+
+        /** Return the number of vertices. */
+        size_t numVertices() const { return m_ids.size(); }
 
-        GraphT& m_g;
+        /** Return the number of edges. */
+        size_t numEdges() const { return m_source.size(); }
 
-        EdgePropertyWriter(GraphT& g) : m_g(g) {}
+        /** Return the contig index of vertex v. */
+        unsigned id(V v) const { return m_ids[v]; }
 
-        void operator()(std::ostream& out, const E& e) const
+        /** Return the degree of vertex v. */
+        size_t degree(V v) const { return m_offsets[v + 1] - m_offsets[v]; }
+
+        /** Return the edges of vertex v. */
+        const_iterator begin(V v) const { return m_incident.data() + m_offsets[v]; }
+        const_iterator end(V v) const { return m_incident.data() + m_offsets[v + 1]; }
+
+        /** Return the vertices of edge e. */
+        V source(E e) const { return m_source[e]; }
+        V target(E e) const { return m_target[e]; }
+
+        int orientation(E e) const { return m_orientation[e]; }
+        int weight(E e) const { return m_weight[e]; }
+        int minDist(E e) const { return m_minDist[e]; }
+        int dist(E e) const { return m_dist[e]; }
+        int maxDist(E e) const { return m_maxDist[e]; }
+        float jaccard(E e) const { return m_jaccard[e]; }
+
+        /** Return true if edge e has a distance estimate. */
+        bool hasDistance(E e) const
+        {
+            return m_minDist[e] != std::numeric_limits<int>::min();
+        }
+
+        /**
+         * Set the distance estimate of edge e. Distinct edges may be
+         * set concurrently.
+         */
+        void setDistance(E e, int minDist, int dist, int maxDist, float jaccard)
         {
-            EP ep = m_g[e];
-            out << '['
-                << "label=" << ep.orientation << ", "
-                << "weight=" << ep.weight;
+            m_minDist[e] = minDist;
+            m_dist[e] = dist;
+            m_maxDist[e] = maxDist;
+            m_jaccard[e] = jaccard;
+        }
 
-            if (ep.minDist != std::numeric_limits<int>::min()) {
-                assert(ep.dist != std::numeric_limits<int>::max());
-                assert(ep.maxDist != std::numeric_limits<int>::max());
-                assert(ep.jaccard >= 0.0f);
-                out << ", "
-                    << "d=" << ep.dist << ", "
-                    << "maxd=" << ep.maxDist;
+        /** Build the graph from a list of links, which have no distance estimates. */
+        void build(const std::vector<ContigLink>& links)
+        {
+            clear();
+            std::vector<V> contigToVertex;
+            for (const auto& link : links) {
+                m_source.push_back(addVertex(link.u, contigToVertex));
+                m_target.push_back(addVertex(link.v, contigToVertex));
+                m_orientation.push_back(link.orientation);
+                m_weight.push_back(link.weight);
             }
-            out << ']';
+            m_minDist.assign(links.size(), std::numeric_limits<int>::min());
+            m_dist.assign(links.size(), std::numeric_limits<int>::max());
+            m_maxDist.assign(links.size(), std::numeric_limits<int>::max());
+            m_jaccard.assign(links.size(), -1.0f);
+            buildIncidence();
         }
-    };
 
-    template <class GraphT>
-    struct VertexPropertyWriter
-    {
-        typedef typename boost::graph_traits<GraphT>::vertex_descriptor V;
-        typedef typename boost::vertex_property<GraphT>::type VP;
+        /**
+         * Remove the vertices for which remove[v] is true and their
+         * edges. The remaining vertices and edges keep their order.
+         */
+        void removeVertices(const std::vector<bool>& remove)
+        {
+            assert(remove.size() == numVertices());
+            std::vector<V> renumber(numVertices());
+            V next = 0;
+            for (V v = 0; v < numVertices(); ++v) {
+                renumber[v] = next;
+                if (!remove[v])
+                    m_ids[next++] = m_ids[v];
+            }
+            m_ids.resize(next);
+
+            E next_e = 0;
+            for (E e = 0; e < numEdges(); ++e) {
+                if (remove[m_source[e]] || remove[m_target[e]])
+                    continue;
+                m_source[next_e] = renumber[m_source[e]];
+                m_target[next_e] = renumber[m_target[e]];
+                m_orientation[next_e] = m_orientation[e];
+                m_weight[next_e] = m_weight[e];
+                m_minDist[next_e] = m_minDist[e];
+                m_dist[next_e] = m_dist[e];
+                m_maxDist[next_e] = m_maxDist[e];
+                m_jaccard[next_e] = m_jaccard[e];
+                ++next_e;
+            }
+            m_source.resize(next_e);
+            m_target.resize(next_e);
+            m_orientation.resize(next_e);
+            m_weight.resize(next_e);
+            m_minDist.resize(next_e);
+            m_dist.resize(next_e);
+            m_maxDist.resize(next_e);
+            m_jaccard.resize(next_e);
+            buildIncidence();
+        }
 
-        GraphT& m_g;
+        void clear()
+        {
+            m_ids.clear();
+            m_source.clear();
+            m_target.clear();
+            m_orientation.clear();
+            m_weight.clear();
+            m_minDist.clear();
+            m_dist.clear();
+            m_maxDist.clear();
+            m_jaccard.clear();
+            buildIncidence();
+        }
 
-        VertexPropertyWriter(GraphT& g) : m_g(g) {}
-        void operator()(std::ostream& out, const V& v) const
+      private:
+        static const V NO_VERTEX = ~V(0);
+
+        /** Return the vertex of a contig, adding it if it is new. */
+        V addVertex(unsigned id, std::vector<V>& contigToVertex)
         {
-            out << " [id=" << m_g[v].id << "]";
+            if (id >= contigToVertex.size())
+                contigToVertex.resize(std::max<size_t>(id + 1, 2 * contigToVertex.size()),
+                        V(NO_VERTEX));
+            if (contigToVertex[id] == NO_VERTEX) {
+                contigToVertex[id] = m_ids.size();
+                m_ids.push_back(id);
+            }
+            return contigToVertex[id];
         }
-    };
 
-	typedef boost::undirected_graph<VertexProperties, EdgeProperties> Graph;
-    typedef std::unordered_map<std::string, Graph::vertex_descriptor> VidVdesMap;
-    typedef boost::graph_traits<ARCS::Graph>::vertex_descriptor VertexDes;
+        /** List the edges of each vertex in increasing order. */
+        void buildIncidence()
+        {
+            m_offsets.assign(numVertices() + 1, 0);
+            for (E e = 0; e < numEdges(); ++e) {
+                m_offsets[m_source[e] + 1]++;
+                m_offsets[m_target[e] + 1]++;
+            }
+            for (size_t v = 1; v < m_offsets.size(); ++v)
+                m_offsets[v] += m_offsets[v - 1];
+
+            m_incident.resize(m_offsets.back());
+            std::vector<size_t> next(m_offsets.begin(), m_offsets.end() - 1);
+            for (E e = 0; e < numEdges(); ++e) {
+                m_incident[next[m_source[e]]++] = e;
+                m_incident[next[m_target[e]]++] = e;
+            }
+        }
+
+        /** the contig index of each vertex */
+        std::vector<unsigned> m_ids;
+        /** the edges of each vertex, m_incident[m_offsets[v]] to m_incident[m_offsets[v + 1]] */
+        std::vector<size_t> m_offsets;
+        std::vector<E> m_incident;
+        /** the properties of each edge */
+        std::vector<V> m_source;
+        std::vector<V> m_target;
+        std::vector<int> m_orientation;
+        std::vector<int> m_weight;
+        std::vector<int> m_minDist;
+        std::vector<int> m_dist;
+        std::vector<int> m_maxDist;
+        std::vector<float> m_jaccard;
+    };
 }
 
 #endif
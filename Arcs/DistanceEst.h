@@ -2,11 +2,13 @@
 #define _DISTANCE_EST_H_ 1
 
 #include "Arcs/Arcs.h"
-#include "Common/MapUtil.h"
-#include "Common/PairHash.h"
+#include "Common/OutputBuffer.h"
+#include "Common/SetIntersect.h"
 #include "Common/StatUtil.h"
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
 #include <limits>
 #include <iostream>
@@ -43,15 +45,108 @@ struct DistSample
 		barcodesUnion(0),
 		barcodesIntersect(0)
 	{}
+
+	/** Return true if the contig has a distance sample. */
+	bool valid() const
+	{
+		return distance != std::numeric_limits<unsigned>::max();
+	}
 };
 
-/** maps contig ID => intra-contig distance/barcode sample */
-typedef std::unordered_map<std::string, DistSample> DistSampleMap;
-typedef typename DistSampleMap::const_iterator DistSampleConstIt;
+/**
+ * intra-contig distance/barcode samples indexed by contig index,
+ * which are not valid() for contigs without a sample
+ */
+typedef std::vector<DistSample> DistSampleMap;
+
+/**
+ * JaccardToDist: the distances of the intra-contig samples sorted by
+ * barcode Jaccard index, keeping the samples with equal indices. The
+ * closest samples to a Jaccard index are a window of dist_bin_size
+ * consecutive samples, whose distance estimate is precomputed. The
+ * window is found by a binary search within the range of windows of
+ * its bucket of Jaccard indices, so a lookup takes time logarithmic in
+ * the number of windows of the bucket, which is all of the windows
+ * when the samples share one bucket. closestWindow then moves at most
+ * one window.
+ */
+class JaccardToDist
+{
+  public:
+	/** The number of buckets of Jaccard indices in [0, 1] */
+	static const size_t NUM_BUCKETS = 1024;
+
+	bool empty() const { return m_estimates.empty(); }
 
-/** maps barcode Jaccard index => intra-contig distance sample */
-typedef std::map<double, DistSample> JaccardToDist;
-typedef typename JaccardToDist::const_iterator JaccardToDistConstIt;
+	/** Return the number of distance samples. */
+	size_t size() const { return m_jaccard.size(); }
+
+	/**
+	 * Set the min, median and max distance of the samples closest to
+	 * a Jaccard index.
+	 */
+	void estimate(double jaccard, DistanceEstimate& est) const
+	{
+		assert(!empty());
+		assert(jaccard >= 0.0 && jaccard <= 1.0);
+		size_t b = std::min(NUM_BUCKETS - 1, size_t(jaccard * NUM_BUCKETS));
+		const DistanceEstimate& x = m_estimates[closestWindow(
+			jaccard, m_buckets[b], m_buckets[b + 1])];
+		est.minDist = x.minDist;
+		est.dist = x.dist;
+		est.maxDist = x.maxDist;
+	}
+
+  private:
+	friend void buildJaccardToDist(const DistSampleMap&,
+		const ARCS::ArcsParams&, JaccardToDist&);
+
+	/**
+	 * Return the window of the samples closest to a Jaccard index,
+	 * which is in the range [first, last]. Window w + 1 is closer than
+	 * window w unless its new sample is farther than the sample that
+	 * it drops, or window w starts at or above the index. Ties go to
+	 * window w + 1, as closestKeys expands its range to the right. The
+	 * distances are signed, so that the test is false and then true as
+	 * w increases, even when Jaccard indices repeat.
+	 */
+	size_t findWindow(double jaccard, size_t first, size_t last) const
+	{
+		const size_t n = m_jaccard.size() - m_estimates.size() + 1;
+		while (first < last) {
+			size_t w = first + (last - first) / 2;
+			if (m_jaccard[w] >= jaccard
+					|| jaccard - m_jaccard[w] < m_jaccard[w + n] - jaccard)
+				last = w;
+			else
+				first = w + 1;
+		}
+		return first;
+	}
+
+	/**
+	 * Return the window that closestKeys chooses for a Jaccard index,
+	 * which is in the range [first, last]. closestKeys starts from the
+	 * closest sample, which on a tie is the sample below the index,
+	 * and includes it even when the window of findWindow starts with
+	 * the sample above the index.
+	 */
+	size_t closestWindow(double jaccard, size_t first, size_t last) const
+	{
+		size_t w = findWindow(jaccard, first, last);
+		if (w > 0 && m_jaccard[w] >= jaccard
+				&& jaccard - m_jaccard[w - 1] <= m_jaccard[w] - jaccard)
+			return w - 1;
+		return w;
+	}
+
+	/** the Jaccard index of each sample, sorted */
+	std::vector<double> m_jaccard;
+	/** the distance estimate of each window */
+	std::vector<DistanceEstimate> m_estimates;
+	/** the window of the first Jaccard index of each bucket */
+	std::vector<size_t> m_buckets;
+};
 
 /** Barcode stats for a candidate pair of contig ends */
 struct BarcodeStats
@@ -71,110 +166,193 @@ enum PairOrientation { HH=0, HT, TH, TT, NUM_ORIENTATIONS };
 /** barcode stats for each possible contig pair orientation (HH,HT,TH,HH) */
 typedef std::array<BarcodeStats, NUM_ORIENTATIONS> BarcodeStatsArray;
 
-/** barcode stats each possible orientation of a contig pair */
-typedef std::map<ARCS::ContigPair, BarcodeStatsArray> PairToBarcodeStats;
-typedef typename PairToBarcodeStats::iterator PairToBarcodeStatsIt;
+/**
+ * barcode stats each possible orientation of the contig pairs
+ * that are graph edges, sorted by contig pair
+ */
+typedef std::vector<std::pair<ARCS::ContigPair, BarcodeStatsArray>> PairToBarcodeStats;
+typedef typename PairToBarcodeStats::const_iterator PairToBarcodeStatsConstIt;
+
+/** Find the barcode stats of a contig pair, or return end(). */
+static inline PairToBarcodeStatsConstIt findPairStats(
+	const PairToBarcodeStats& pairToStats, const ARCS::ContigPair& pair)
+{
+	PairToBarcodeStatsConstIt it = std::lower_bound(
+		pairToStats.begin(), pairToStats.end(), pair,
+		[](const PairToBarcodeStats::value_type& a, const ARCS::ContigPair& b) {
+			return a.first < b;
+		});
+	return it != pairToStats.end() && it->first == pair
+		? it : pairToStats.end();
+}
+
+/**
+ * EndBarcodeList: contig ends and the barcodes that are valid for
+ * distance estimates, listed barcode by barcode
+ */
+typedef std::vector<std::pair<ARCS::CI, uint32_t>> EndBarcodeList;
+
+/**
+ * EndToBarcodes: the barcodes of each contig end that are valid for
+ * distance estimates, as sorted lists of their indices in the IndexMap
+ */
+class EndToBarcodes
+{
+  public:
+	typedef const uint32_t* const_iterator;
+
+	EndToBarcodes() : m_offsets(1, 0) {}
+
+	/** Return the barcodes of a contig end. */
+	const_iterator begin(ARCS::CI end) const
+	{
+		return m_barcodes.data() + m_offsets[end];
+	}
+	const_iterator end(ARCS::CI end) const
+	{
+		return m_barcodes.data() + m_offsets[end + 1];
+	}
+	unsigned size(ARCS::CI end) const
+	{
+		return m_offsets[end + 1] - m_offsets[end];
+	}
+
+	/** Return the number of barcodes shared by two contig ends. */
+	unsigned countShared(ARCS::CI a, ARCS::CI b) const
+	{
+		return countIntersection(begin(a), size(a), begin(b), size(b));
+	}
+
+	/** Return the number of contig ends. */
+	size_t numEnds() const { return m_offsets.size() - 1; }
+
+  private:
+	friend void buildEndToBarcodes(const EndBarcodeList&, size_t,
+		EndToBarcodes&);
+
+	std::vector<size_t> m_offsets;
+	std::vector<uint32_t> m_barcodes;
+};
 
 /**
  * Measure distance between contig ends vs.
  * barcode intersection size and barcode union size.
+ * The contigs are measured in parallel.
  */
-void calcDistSamples(const ARCS::IndexMap& imap,
+void calcDistSamples(const EndToBarcodes& endToBarcodes,
 	const ARCS::ContigToLength& contigToLength,
-	const std::unordered_map<std::string, int>& indexMultMap,
 	const ARCS::ArcsParams& params,
 	DistSampleMap& distSamples)
 {
-	/* for each chromium barcode */
-	for (auto barcodeIt = imap.begin(); barcodeIt != imap.end();
-		++barcodeIt)
+	const size_t numContigs = endToBarcodes.numEnds() / 2;
+	const unsigned threads = params.threads > 0 ? params.threads : 1;
+	distSamples.assign(numContigs, DistSample());
+
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 256)
+	for (size_t contigID = 0; contigID < numContigs; ++contigID)
 	{
-		/* skip barcodes outside of min/max multiplicity range */
-		std::string index = barcodeIt->first;
-		int indexMult = indexMultMap.at(index);
-		if (indexMult < params.min_mult || indexMult > params.max_mult)
+		/*
+		 * skip contigs shorter than 2 times the contig
+		 * end length, because we want our distance samples
+		 * to be based on a uniform head/tail length
+		 */
+
+		unsigned l = contigToLength[contigID];
+		if (l < (unsigned) 2 * params.end_length)
 			continue;
 
-		/* contig head/tail => number of mapped read pairs */
-		const ARCS::ScafMap& contigToCount = barcodeIt->second;
-
-		for (auto contigIt = contigToCount.begin();
-			contigIt != contigToCount.end(); ++contigIt)
-		{
-			std::string contigID;
-			bool isHead;
-			std::tie(contigID, isHead) = contigIt->first;
-			int readPairs = contigIt->second;
-
-			/*
-			 * skip contigs with less than required number of
-			 * mapped read pairs (-c option)
-			 */
-			if (readPairs < params.min_reads)
-				continue;
-
-			/*
-			 * skip contigs shorter than 2 times the contig
-			 * end length, because we want our distance samples
-			 * to be based on a uniform head/tail length
-			 */
-
-			unsigned l = contigToLength.at(contigID);
-			if (l < (unsigned) 2 * params.end_length)
-				continue;
-
-			DistSample& distSample = distSamples[contigID];
-			distSample.distance = l - 2 * params.end_length;
+		ARCS::CI head = ARCS::contigEnd(contigID, true);
+		ARCS::CI tail = ARCS::contigEnd(contigID, false);
+		if (endToBarcodes.size(head) == 0 && endToBarcodes.size(tail) == 0)
+			continue;
 
-			if (isHead)
-				distSample.barcodesHead++;
-			else
-				distSample.barcodesTail++;
-
-			/*
-			 * Check if barcode also maps to other end of contig
-			 * with sufficient number of read pairs.
-			 *
-			 * The `isHead` part of the `if` condition prevents
-			 * double-counting when a barcode maps to both
-			 * ends of a contig.
-			 */
-
-			ARCS::CI otherEnd(contigID, !isHead);
-			ARCS::ScafMapConstIt otherIt = contigToCount.find(otherEnd);
-			bool foundOther = otherIt != contigToCount.end()
-				&& otherIt->second >= params.min_reads;
-
-			if (foundOther && isHead) {
-				distSample.barcodesIntersect++;
-				distSample.barcodesUnion++;
-			} else if (!foundOther) {
-				distSample.barcodesUnion++;
-			}
-		}
+		DistSample& distSample = distSamples[contigID];
+		distSample.distance = l - 2 * params.end_length;
+		distSample.barcodesHead = endToBarcodes.size(head);
+		distSample.barcodesTail = endToBarcodes.size(tail);
+		distSample.barcodesIntersect = endToBarcodes.countShared(head, tail);
+		distSample.barcodesUnion = distSample.barcodesHead
+			+ distSample.barcodesTail - distSample.barcodesIntersect;
 	}
 }
 
 /**
- * Build a ordered map from barcode Jaccard index to
- * distance sample. Each distance sample comes from
+ * Build the table from barcode Jaccard index to distance
+ * sample. Each distance sample comes from
  * measuring the distance between the head/tail of the
  * same contig, along with associated head/tail barcode
- * counts.
+ * counts. The 1st percentile, median and 99th percentile
+ * distance of each window of dist_bin_size samples is
+ * computed while sliding the window along the samples.
  */
-static inline void buildJaccardToDist(
+void buildJaccardToDist(
 	const DistSampleMap& distSamples,
+	const ARCS::ArcsParams& params,
 	JaccardToDist& jaccardToDist)
 {
-	for (DistSampleConstIt it = distSamples.begin();
-		it != distSamples.end(); ++it)
+	std::vector<std::pair<double, unsigned>> samples;
+	for (const DistSample& sample : distSamples)
 	{
-		const DistSample& sample = it->second;
+		if (!sample.valid())
+			continue;
 		double jaccard = double(sample.barcodesIntersect)
 			/ sample.barcodesUnion;
-		jaccardToDist.insert(
-			JaccardToDist::value_type(jaccard, sample));
+		samples.push_back(std::make_pair(jaccard, sample.distance));
+	}
+	std::sort(samples.begin(), samples.end());
+
+	JaccardToDist table;
+	for (const auto& sample : samples)
+		table.m_jaccard.push_back(sample.first);
+	if (samples.empty()) {
+		std::swap(jaccardToDist, table);
+		return;
 	}
+
+	/* window w is samples[w] to samples[w + n - 1] */
+	const size_t n = std::max<size_t>(1,
+		std::min<size_t>(params.dist_bin_size, samples.size()));
+	const size_t numWindows = samples.size() - n + 1;
+
+	/* the sorted distances of the window */
+	std::vector<unsigned> distances;
+	for (size_t i = 0; i < n; ++i)
+		distances.push_back(samples[i].second);
+	std::sort(distances.begin(), distances.end());
+
+	for (size_t w = 0; w < numWindows; ++w) {
+		if (w > 0) {
+			unsigned out = samples[w - 1].second;
+			unsigned in = samples[w + n - 1].second;
+			distances.erase(std::lower_bound(
+				distances.begin(), distances.end(), out));
+			distances.insert(std::upper_bound(
+				distances.begin(), distances.end(), in), in);
+		}
+
+		/* use 1st percentile, median, and 99th percentile */
+		DistanceEstimate est;
+		est.minDist = (int)floor(
+			quantile(distances.begin(), distances.end(), 0.01));
+		est.dist = (int)round(
+			quantile(distances.begin(), distances.end(), 0.5));
+		est.maxDist = (int)ceil(
+			quantile(distances.begin(), distances.end(), 0.99));
+		table.m_estimates.push_back(est);
+	}
+
+	/*
+	 * The window of findWindow increases with the Jaccard index, so the
+	 * windows of a bucket are within the windows of its bounds
+	 */
+	const size_t B = JaccardToDist::NUM_BUCKETS;
+	table.m_buckets.resize(B + 1);
+	for (size_t b = 0; b < B; ++b)
+		table.m_buckets[b] = table.findWindow(double(b) / B,
+			b > 0 ? table.m_buckets[b - 1] : 0, numWindows - 1);
+	table.m_buckets[B] = numWindows - 1;
+
+	std::swap(jaccardToDist, table);
 }
 
 /**
@@ -205,134 +383,113 @@ static inline bool validBarcodeMapping(unsigned contigLength,
 	return true;
 }
 
-/** calculate shared barcode stats for candidate contig pairs */
-static inline void buildPairToBarcodeStats(
-	const ARCS::IndexMap& imap,
-	const std::unordered_map<std::string, int>& indexMultMap,
+/**
+ * Add the contig ends of one barcode that are valid for distance
+ * estimates to a list. The barcode is numbered index, and must be in
+ * the min/max multiplicity range.
+ */
+static inline void listEndBarcodes(const ARCS::ScafMap& scafMap,
+	uint32_t index,
 	const ARCS::ContigToLength& contigToLength,
 	const ARCS::ArcsParams& params,
-	PairToBarcodeStats& pairToStats)
+	EndBarcodeList& list)
 {
-	typedef std::unordered_map<ARCS::CI, size_t, PairHash> ContigEndToBarcodeCount;
-	typedef typename ContigEndToBarcodeCount::const_iterator BarcodeCountConstIt;
-	ContigEndToBarcodeCount contigEndToBarcodeCount;
-
-	/* calculate number of shared barcodes for candidate contig end pairs */
-
-	for (auto barcodeIt = imap.begin(); barcodeIt != imap.end();
-		++barcodeIt)
-	{
-		/* skip barcodes outside of min/max multiplicity range */
-		std::string index = barcodeIt->first;
-		int indexMult = indexMultMap.at(index);
-		if (indexMult < params.min_mult || indexMult > params.max_mult)
-			continue;
-
-		/* contig head/tail => number of mapped read pairs */
-		const ARCS::ScafMap& contigEndToPairCount = barcodeIt->second;
-
-		for (auto endIt1 = contigEndToPairCount.begin();
-			endIt1 != contigEndToPairCount.end(); ++endIt1)
-		{
-			/* get contig ID and head/tail flag */
-			std::string id1;
-			bool head1;
-			std::tie(id1, head1) = endIt1->first;
-
-			/* check requirements for calculating distance estimates */
-			unsigned length1 = contigToLength.at(id1);
-			int pairs1 = endIt1->second;
-			if (!validBarcodeMapping(length1, pairs1, params))
-				continue;
-
-			/* count distinct barcodes mapped to head/tail of each contig */
-			contigEndToBarcodeCount[endIt1->first]++;
-
-			for (auto endIt2 = contigEndToPairCount.begin();
-				 endIt2 != contigEndToPairCount.end(); ++endIt2)
-			{
-				/* get contig ID and head/tail flag */
-				std::string id2;
-				bool head2;
-				std::tie(id2, head2) = endIt2->first;
-
-				/* check requirements for calculating distance estimates */
-				unsigned length2 = contigToLength.at(endIt2->first.first);
-				int pairs2 = endIt2->second;
-				if (!validBarcodeMapping(length2, pairs2, params))
-					continue;
-
-				/* avoid double-counting contig end pairs */
-				if (id1 > id2)
-					continue;
-
-				/* initialize barcode/weight data for contig end pair */
-				ARCS::ContigPair pair(id1, id2);
-				if (pairToStats.count(pair) == 0)
-					pairToStats[pair].fill(BarcodeStats());
-
-				// Head - Head
-				if (head1 && head2) {
-					pairToStats[pair][0].barcodesIntersect++;
-				// Head - Tail
-				} else if (head1 && !head2) {
-					pairToStats[pair][1].barcodesIntersect++;
-				// Tail - Head
-				} else if (!head1 && head2) {
-					pairToStats[pair][2].barcodesIntersect++;
-				// Tail - Tail
-				} else if (!head1 && !head2) {
-					pairToStats[pair][3].barcodesIntersect++;
-				}
-			}
-		}
+	for (const auto& endCount : scafMap) {
+		unsigned id = ARCS::contigIndex(endCount.first);
+		if (validBarcodeMapping(contigToLength.at(id), endCount.second, params))
+			list.push_back(std::make_pair(endCount.first, index));
 	}
+}
+
+/**
+ * Build EndToBarcodes from a list of contig ends and their barcodes,
+ * in which the barcodes are in increasing order.
+ */
+void buildEndToBarcodes(const EndBarcodeList& list, size_t numEnds,
+	EndToBarcodes& endToBarcodes)
+{
+	std::vector<size_t> offsets(numEnds + 1);
+	for (const auto& x : list)
+		offsets[x.first + 1]++;
+	for (size_t end = 1; end < offsets.size(); ++end)
+		offsets[end] += offsets[end - 1];
+
+	std::vector<uint32_t> barcodes(list.size());
+	std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+	for (const auto& x : list)
+		barcodes[next[x.first]++] = x.second;
+
+	endToBarcodes.m_offsets.swap(offsets);
+	endToBarcodes.m_barcodes.swap(barcodes);
+}
 
+/**
+ * calculate shared barcode stats for the contig pairs that are edges
+ * of the graph, where the first contig of each pair precedes the
+ * second by FASTA ID
+ */
+static inline void buildPairToBarcodeStats(
+	const EndToBarcodes& endToBarcodes,
+	const ARCS::Graph& g,
+	PairToBarcodeStats& pairToStats)
+{
 	/*
-	 * Compute/store further barcode stats for each candidate
+	 * Compute/store barcode stats for each orientation of each
 	 * contig pair:
 	 *
 	 * (1) number of distinct barcodes mapping to contig A (|A|)
 	 * (2) number of distinct barcodes mapping to contig B (|B|)
-	 * (3) barcode union size for contigs A and B (|A union B|)
+	 * (3) barcode intersection size for contigs A and B (|A intersect B|)
+	 * (4) barcode union size for contigs A and B (|A union B|)
+	 *
+	 * Pairs that share no barcodes in any orientation are skipped.
 	 */
 
-	for (PairToBarcodeStatsIt it = pairToStats.begin(); it != pairToStats.end(); ++it)
+	pairToStats.clear();
+	for (ARCS::Graph::E e = 0; e < g.numEdges(); ++e)
 	{
+		unsigned id1 = g.id(g.source(e));
+		unsigned id2 = g.id(g.target(e));
+
+		BarcodeStatsArray statsArray;
+		bool shared = false;
 		for (PairOrientation i = HH; i < NUM_ORIENTATIONS;
 			i = PairOrientation(i + 1))
 		{
-			BarcodeStats& stats = it->second.at(i);
+			BarcodeStats& stats = statsArray.at(i);
 
-			const std::string& id1 = it->first.first;
-			const std::string& id2 = it->first.second;
+			ARCS::CI tail1 = ARCS::contigEnd(id1, i == HH || i == HT);
+			ARCS::CI tail2 = ARCS::contigEnd(id2, i == HH || i == TH);
 
-			ARCS::CI tail1(id1, i == HH || i == HT);
-			ARCS::CI tail2(id2, i == HH || i == TH);
+			stats.barcodesIntersect = endToBarcodes.countShared(tail1, tail2);
+			shared = shared || stats.barcodesIntersect > 0;
 
-			BarcodeCountConstIt countIt1 = contigEndToBarcodeCount.find(tail1);
-			if (countIt1 == contigEndToBarcodeCount.end())
+			stats.barcodes1 = endToBarcodes.size(tail1);
+			if (stats.barcodes1 == 0)
 				continue;
-			stats.barcodes1 = countIt1->second;
-			assert(stats.barcodes1 > 0);
 
-			BarcodeCountConstIt countIt2 = contigEndToBarcodeCount.find(tail2);
-			if (countIt2 == contigEndToBarcodeCount.end())
+			stats.barcodes2 = endToBarcodes.size(tail2);
+			if (stats.barcodes2 == 0)
 				continue;
-			stats.barcodes2 = countIt2->second;
-			assert(stats.barcodes2 > 0);
 
 			assert(stats.barcodes1 + stats.barcodes2 >= stats.barcodesIntersect);
 			stats.barcodesUnion = stats.barcodes1 + stats.barcodes2
 				- stats.barcodesIntersect;
 		}
+		if (shared)
+			pairToStats.push_back(std::make_pair(
+				ARCS::ContigPair(id1, id2), statsArray));
 	}
+	std::sort(pairToStats.begin(), pairToStats.end(),
+		[](const PairToBarcodeStats::value_type& a,
+			const PairToBarcodeStats::value_type& b) {
+			return a.first < b.first;
+		});
 }
 
 /** estimate min/max distance between a pair of contigs */
 std::pair<DistanceEstimate, bool> estimateDistance(
-	const BarcodeStats& stats, const JaccardToDist& jaccardToDist,
-	const ARCS::ArcsParams& params)
+	const BarcodeStats& stats, const JaccardToDist& jaccardToDist)
 {
 	DistanceEstimate result;
 
@@ -359,83 +516,135 @@ std::pair<DistanceEstimate, bool> estimateDistance(
 	assert(result.jaccard >= 0.0 && result.jaccard <= 1.0);
 
 	/*
-	 * get intra-contig distance samples with
-	 * with closest Jaccard scores
+	 * get the distance estimate of the intra-contig distance
+	 * samples with the closest Jaccard scores
 	 */
 
-	JaccardToDistConstIt lowerIt, upperIt;
-	std::tie(lowerIt, upperIt) =
-		closestKeys(jaccardToDist, result.jaccard,
-			params.dist_bin_size);
+	jaccardToDist.estimate(result.jaccard, result);
 
-	std::vector<unsigned> distances;
-	for (JaccardToDistConstIt sampleIt = lowerIt;
-		 sampleIt != upperIt; ++sampleIt)
-	{
-		distances.push_back(sampleIt->second.distance);
-	}
+	return std::make_pair(result, true);
+}
 
-	std::sort(distances.begin(), distances.end());
 
-	/* use 1st percentile, median, and 99th percentile */
+/** a graph edge and the barcode stats of its contig ends */
+struct EdgeStats
+{
+	ARCS::Graph::E edge;
+	const BarcodeStats* stats;
+};
 
-	result.minDist =
-		(int)floor(quantile(distances.begin(), distances.end(), 0.01));
-	result.dist =
-		(int)round(quantile(distances.begin(), distances.end(), 0.5));
-	result.maxDist =
-		(int)ceil(quantile(distances.begin(), distances.end(), 0.99));
+/** the graph edges that have barcode stats, in order */
+typedef std::vector<EdgeStats> EdgeStatsList;
 
-	return std::make_pair(result, true);
-}
+/** list the graph edges that have barcode stats */
+static inline void listEdgeStats(
+	const PairToBarcodeStats& pairToStats, const ARCS::Graph& g,
+	unsigned threads, EdgeStatsList& list)
+{
+	list.resize(g.numEdges());
+
+#pragma omp parallel for num_threads(threads) schedule(static)
+	for (size_t e = 0; e < list.size(); ++e) {
+		list[e].edge = e;
+		list[e].stats = NULL;
+		auto pair = std::make_pair(g.id(g.source(e)), g.id(g.target(e)));
+		auto statsIt = findPairStats(pairToStats, pair);
+		if (statsIt != pairToStats.end())
+			list[e].stats = &statsIt->second.at(g.orientation(e));
+	}
 
+	list.erase(std::remove_if(list.begin(), list.end(),
+		[](const EdgeStats& x) { return x.stats == NULL; }), list.end());
+}
 
 /** add distance estimates to output graph edges */
 static inline void addEdgeDistances(
-	const PairToBarcodeStats& pairToStats,
+	const EdgeStatsList& edgeStats,
 	const JaccardToDist& jaccardToDist,
-	const ARCS::ArcsParams& params, ARCS::Graph& g)
+	unsigned threads, ARCS::Graph& g)
 {
 	if (jaccardToDist.empty())
 		return;
 
-	for (const auto e : boost::make_iterator_range(boost::edges(g))) {
-
-		auto v1 = source(e, g);
-		auto v2 = target(e, g);
-
-		auto id1 = g[v1].id;
-		auto id2 = g[v2].id;
-
-		auto orientation = g[e].orientation;
-
-		auto pair = std::make_pair(id1, id2);
-		auto statsIt = pairToStats.find(pair);
-		if (statsIt == pairToStats.end())
-			continue;
-		const BarcodeStats& stats = statsIt->second.at(orientation);
+	/* each edge is written by one thread only */
+#pragma omp parallel for num_threads(threads) schedule(static)
+	for (size_t i = 0; i < edgeStats.size(); ++i) {
 
 		DistanceEstimate est;
 		bool success;
 
-		std::tie(est, success) = estimateDistance(stats, jaccardToDist, params);
+		std::tie(est, success) = estimateDistance(
+			*edgeStats[i].stats, jaccardToDist);
 		if (!success)
 			continue;
 
-		g[e].minDist = est.minDist;
-		g[e].dist = est.dist;
-		g[e].maxDist = est.maxDist;
-		g[e].jaccard = est.jaccard;
+		g.setDistance(edgeStats[i].edge,
+			est.minDist, est.dist, est.maxDist, est.jaccard);
+
+	}
+}
 
+/** write the TSV lines of a graph edge, one for each direction */
+static inline void writeDistTSVEdge(OutputBuffer& out,
+	const EdgeStats& edgeStats, const ARCS::Graph& g,
+	const ARCS::ContigToName& names)
+{
+	const auto e = edgeStats.edge;
+	const BarcodeStats& stats = *edgeStats.stats;
+	auto orientation = g.orientation(e);
+
+	bool sense1 = orientation < 2;
+	bool sense2 = orientation % 2;
+
+	const StringRef& name1 = names[g.id(g.source(e))];
+	const StringRef& name2 = names[g.id(g.target(e))];
+
+	out << name1 << (sense1 ? '-' : '+') << '\t'
+		<< name2 << (sense2 ? '-' : '+') << '\t';
+	if (g.jaccard(e) >= 0) {
+		out << g.minDist(e) << '\t'
+			<< g.dist(e) << '\t'
+			<< g.maxDist(e) << '\t';
+	} else {
+		out << "NA" << '\t'
+			<< "NA" << '\t'
+			<< "NA" << '\t';
 	}
+	out << stats.barcodes1 << '\t'
+		<< stats.barcodes2 << '\t'
+		<< stats.barcodesUnion << '\t'
+		<< stats.barcodesIntersect << '\n';
+
+	out << name2 << (sense2 ? '+' : '-') << '\t'
+		<< name1 << (sense1 ? '+' : '-') << '\t';
+	if (g.jaccard(e) >= 0) {
+		out << g.minDist(e) << '\t'
+			<< g.dist(e) << '\t'
+			<< g.maxDist(e) << '\t';
+	} else {
+		out << "NA" << '\t'
+			<< "NA" << '\t'
+			<< "NA" << '\t';
+	}
+	out << stats.barcodes2 << '\t'
+		<< stats.barcodes1 << '\t'
+		<< stats.barcodesUnion << '\t'
+		<< stats.barcodesIntersect << '\n';
 }
 
-/** dump distance estimates and barcode data to TSV */
+/**
+ * dump distance estimates and barcode data to TSV. Blocks of edges
+ * are formatted in parallel and written in order.
+ */
 static inline void writeDistTSV(const std::string& path,
-	const PairToBarcodeStats& pairToStats, const ARCS::Graph& g)
+	const EdgeStatsList& edgeStats, const ARCS::Graph& g,
+	unsigned threads)
 {
 	assert(!path.empty());
 
+	ARCS::ContigToName names;
+	ARCS::listContigNames(names);
+
 	/* open output TSV file */
 
 	ofstream tsvOut;
@@ -454,59 +663,11 @@ static inline void writeDistTSV(const std::string& path,
 		<< "barcodes_intersect" << '\n';
 	assert(tsvOut);
 
-	for (const auto e : boost::make_iterator_range(boost::edges(g))) {
-
-		auto v1 = source(e, g);
-		auto v2 = target(e, g);
-
-		auto id1 = g[v1].id;
-		auto id2 = g[v2].id;
-
-		auto orientation = g[e].orientation;
-
-		auto pair = std::make_pair(id1, id2);
-		auto statsIt = pairToStats.find(pair);
-		if (statsIt == pairToStats.end())
-			continue;
-		const BarcodeStats& stats = statsIt->second.at(orientation);
-
-		bool sense1 = orientation < 2;
-		bool sense2 = orientation % 2;
-
-		tsvOut << pair.first << (sense1 ? '-' : '+') << '\t'
-			<< pair.second << (sense2 ? '-' : '+') << '\t';
-		if (g[e].jaccard >= 0) {
-			tsvOut << g[e].minDist << '\t'
-				<< g[e].dist << '\t'
-				<< g[e].maxDist << '\t';
-		} else {
-			tsvOut << "NA" << '\t'
-				<< "NA" << '\t'
-				<< "NA" << '\t';
-		}
-		tsvOut << stats.barcodes1 << '\t'
-			<< stats.barcodes2 << '\t'
-			<< stats.barcodesUnion << '\t'
-			<< stats.barcodesIntersect << '\n';
-
-		tsvOut << pair.second << (sense2 ? '+' : '-') << '\t'
-			<< pair.first << (sense1 ? '+' : '-') << '\t';
-		if (g[e].jaccard >= 0) {
-			tsvOut << g[e].minDist << '\t'
-				<< g[e].dist << '\t'
-				<< g[e].maxDist << '\t';
-		} else {
-			tsvOut << "NA" << '\t'
-				<< "NA" << '\t'
-				<< "NA" << '\t';
-		}
-		tsvOut << stats.barcodes2 << '\t'
-			<< stats.barcodes1 << '\t'
-			<< stats.barcodesUnion << '\t'
-			<< stats.barcodesIntersect << '\n';
-
-		assert(tsvOut);
-	}
+	writeBlocks(tsvOut, edgeStats.size(), threads,
+		[&](OutputBuffer& out, size_t i) {
+			writeDistTSVEdge(out, edgeStats[i], g, names);
+		});
+	assert(tsvOut);
 
 	tsvOut.close();
 }
@@ -527,13 +688,13 @@ static inline std::ostream& writeDistSamplesTSV(std::ostream& out,
 		<< "barcodes_union" << '\t'
 		<< "barcodes_intersect" << '\n';
 
-	for (DistSampleConstIt it = distSamples.begin();
-		it != distSamples.end(); ++it)
+	for (size_t contigID = 0; contigID < distSamples.size(); ++contigID)
 	{
-		const std::string& contigID = it->first;
-		const DistSample& sample = it->second;
+		const DistSample& sample = distSamples[contigID];
+		if (!sample.valid())
+			continue;
 
-		out << contigID << '\t'
+		out << g_contigNames.getName(contigID) << '\t'
 			<< sample.distance << '\t'
 			<< sample.barcodesHead << '\t'
 			<< sample.barcodesTail << '\t'
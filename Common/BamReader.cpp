@@ -0,0 +1,320 @@
+/**
+ * Read a BAM file without piping it through `samtools view`.
+ * A BAM file is a series of BGZF blocks, each of which is an
+ * independent raw DEFLATE stream of at most 64 kB. Batches of
+ * blocks are read sequentially and inflated in parallel.
+ */
+
+#include "BamReader.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <zlib.h>
+
+using namespace std;
+
+/** Size of the fixed part of a BGZF block header */
+static const size_t BGZF_HEADER = 12;
+
+/** Size of the BGZF block footer (CRC32 and ISIZE) */
+static const size_t BGZF_FOOTER = 8;
+
+/** Size of the fixed part of a BAM alignment record */
+static const size_t BAM_CORE = 32;
+
+/** Number of BGZF blocks to decompress per thread in each batch */
+static const size_t BLOCKS_PER_THREAD = 32;
+
+/** Read a little-endian integer. */
+static inline uint16_t getLE16(const void* p)
+{
+	const unsigned char* q = static_cast<const unsigned char*>(p);
+	return uint16_t(q[0] | q[1] << 8);
+}
+
+/** Read a little-endian integer. */
+static inline uint32_t getLE32(const void* p)
+{
+	const unsigned char* q = static_cast<const unsigned char*>(p);
+	return uint32_t(q[0]) | uint32_t(q[1]) << 8
+		| uint32_t(q[2]) << 16 | uint32_t(q[3]) << 24;
+}
+
+uint32_t BamRecord::cigar(unsigned i) const
+{
+	assert(i < n_cigar_op);
+	return getLE32(cigarData + 4 * i);
+}
+
+BamReader::BamReader(const string& path, unsigned threads)
+	// The mode "rb" bypasses the uncompress hook of fopen.
+	: m_path(path), m_in(fopen(path.c_str(), "rb")),
+	m_threads(threads > 0 ? threads : 1), m_pos(0)
+{
+	if (m_in == NULL)
+		die(strerror(errno));
+
+	char magic[4];
+	readBytes(magic, sizeof magic);
+	if (memcmp(magic, "BAM\1", 4) != 0)
+		die("not a BAM file");
+
+	char buf[4];
+	readBytes(buf, 4);
+	m_text.resize(getLE32(buf));
+	if (!m_text.empty())
+		readBytes(&m_text[0], m_text.size());
+	// The header text may be padded with NUL.
+	m_text.resize(strlen(m_text.c_str()));
+
+	readBytes(buf, 4);
+	uint32_t n_ref = getLE32(buf);
+	m_refs.reserve(n_ref);
+	for (uint32_t i = 0; i < n_ref; ++i) {
+		readBytes(buf, 4);
+		uint32_t l_name = getLE32(buf);
+		if (l_name == 0)
+			die("invalid reference name");
+		string name(l_name, '\0');
+		readBytes(&name[0], l_name);
+		name.resize(l_name - 1);
+		readBytes(buf, 4);
+		m_refs.push_back(Reference(name, int32_t(getLE32(buf))));
+	}
+}
+
+BamReader::~BamReader()
+{
+	if (m_in != NULL)
+		fclose(m_in);
+}
+
+void BamReader::die(const string& msg) const
+{
+	cerr << "error: `" << m_path << "': " << msg << endl;
+	exit(EXIT_FAILURE);
+}
+
+void BamReader::readBytes(void* dest, size_t n)
+{
+	if (!fill(n))
+		die("unexpected end of file");
+	memcpy(dest, &m_buf[m_pos], n);
+	m_pos += n;
+}
+
+bool BamReader::fill(size_t n)
+{
+	while (m_buf.size() - m_pos < n) {
+		// Discard the consumed data.
+		m_buf.erase(m_buf.begin(), m_buf.begin() + m_pos);
+		m_pos = 0;
+		if (!readBlocks())
+			return false;
+	}
+	return true;
+}
+
+bool BamReader::readBlocks()
+{
+	m_blocks.clear();
+	m_blockStart.clear();
+	m_cdataStart.clear();
+
+	// Read the compressed blocks of this batch.
+	size_t maxBlocks = BLOCKS_PER_THREAD * m_threads;
+	unsigned char header[BGZF_HEADER];
+	while (m_blockStart.size() < maxBlocks) {
+		size_t n = fread(header, 1, BGZF_HEADER, m_in);
+		if (n == 0 && feof(m_in))
+			break;
+		if (n != BGZF_HEADER)
+			die("truncated BGZF block");
+		if (header[0] != 31 || header[1] != 139 || header[2] != 8
+				|| (header[3] & 4) == 0)
+			die("not a BGZF file");
+
+		// Find the block size in the BC subfield.
+		size_t xlen = getLE16(header + 10);
+		size_t start = m_blocks.size();
+		m_blocks.resize(start + BGZF_HEADER + xlen);
+		memcpy(&m_blocks[start], header, BGZF_HEADER);
+		unsigned char* extra = &m_blocks[start + BGZF_HEADER];
+		if (fread(extra, 1, xlen, m_in) != xlen)
+			die("truncated BGZF block");
+		size_t bsize = 0;
+		for (size_t i = 0; i + 4 <= xlen;) {
+			size_t slen = getLE16(extra + i + 2);
+			if (extra[i] == 'B' && extra[i + 1] == 'C' && slen == 2)
+				bsize = getLE16(extra + i + 4) + 1;
+			i += 4 + slen;
+		}
+		if (bsize < BGZF_HEADER + xlen + BGZF_FOOTER)
+			die("invalid BGZF block size");
+
+		size_t cdata = start + BGZF_HEADER + xlen;
+		m_blocks.resize(start + bsize);
+		if (fread(&m_blocks[cdata], 1, start + bsize - cdata, m_in)
+				!= start + bsize - cdata)
+			die("truncated BGZF block");
+		m_blockStart.push_back(start);
+		m_cdataStart.push_back(cdata);
+	}
+	if (ferror(m_in))
+		die(strerror(errno));
+	if (m_blockStart.empty())
+		return false;
+
+	// Find the position of each block in the decompressed data.
+	size_t nblocks = m_blockStart.size();
+	m_blockStart.push_back(m_blocks.size());
+	vector<size_t> outStart(nblocks + 1);
+	outStart[0] = m_buf.size();
+	for (size_t i = 0; i < nblocks; ++i) {
+		const unsigned char* footer
+			= &m_blocks[m_blockStart[i + 1] - BGZF_FOOTER];
+		outStart[i + 1] = outStart[i] + getLE32(footer + 4);
+	}
+	m_buf.resize(outStart[nblocks]);
+
+	// Decompress the blocks.
+	vector<char> failed(nblocks, false);
+#pragma omp parallel for num_threads(m_threads) schedule(dynamic)
+	for (size_t i = 0; i < nblocks; ++i) {
+		const unsigned char* footer
+			= &m_blocks[m_blockStart[i + 1] - BGZF_FOOTER];
+		size_t isize = outStart[i + 1] - outStart[i];
+		if (isize == 0)
+			continue;
+		Bytef* out = reinterpret_cast<Bytef*>(&m_buf[outStart[i]]);
+
+		z_stream zs;
+		memset(&zs, 0, sizeof zs);
+		zs.next_in = &m_blocks[m_cdataStart[i]];
+		zs.avail_in = footer - zs.next_in;
+		zs.next_out = out;
+		zs.avail_out = isize;
+		bool ok = inflateInit2(&zs, -15) == Z_OK;
+		ok = ok && inflate(&zs, Z_FINISH) == Z_STREAM_END
+			&& zs.avail_out == 0;
+		inflateEnd(&zs);
+		failed[i] = !ok
+			|| crc32(crc32(0L, Z_NULL, 0), out, isize) != getLE32(footer);
+	}
+	for (size_t i = 0; i < nblocks; ++i)
+		if (failed[i])
+			die("corrupt BGZF block");
+	return true;
+}
+
+bool BamReader::read(BamRecord& rec)
+{
+	if (!fill(4)) {
+		if (m_pos < m_buf.size())
+			die("truncated alignment record");
+		return false;
+	}
+	size_t blockSize = getLE32(&m_buf[m_pos]);
+	m_pos += 4;
+	if (blockSize < BAM_CORE || !fill(blockSize))
+		die("truncated alignment record");
+
+	const char* p = &m_buf[m_pos];
+	const char* end = p + blockSize;
+	m_pos += blockSize;
+
+	rec.refID = int32_t(getLE32(p));
+	rec.pos = int32_t(getLE32(p + 4));
+	uint8_t l_read_name = uint8_t(p[8]);
+	rec.mapq = uint8_t(p[9]);
+	rec.n_cigar_op = getLE16(p + 12);
+	rec.flag = getLE16(p + 14);
+	rec.l_seq = int32_t(getLE32(p + 16));
+	rec.next_refID = int32_t(getLE32(p + 20));
+	rec.next_pos = int32_t(getLE32(p + 24));
+	if (l_read_name == 0 || rec.l_seq < 0
+			|| BAM_CORE + l_read_name + 4 * size_t(rec.n_cigar_op)
+				+ (size_t(rec.l_seq) + 1) / 2 + size_t(rec.l_seq)
+				> blockSize)
+		die("invalid alignment record");
+
+	const char* q = p + BAM_CORE;
+	rec.readName = q;
+	q += l_read_name;
+	if (q[-1] != '\0')
+		die("invalid read name");
+	rec.cigarData = q;
+	q += 4 * size_t(rec.n_cigar_op);
+	q += (size_t(rec.l_seq) + 1) / 2 + size_t(rec.l_seq);
+
+	rec.qalen = 0;
+	for (unsigned i = 0; i < rec.n_cigar_op; ++i) {
+		uint32_t op = rec.cigar(i);
+		switch (op & 0xf) {
+		  case 0: // M
+		  case 1: // I
+		  case 7: // =
+		  case 8: // X
+			rec.qalen += op >> 4;
+			break;
+		}
+	}
+
+	// Find the NM and BX tags.
+	rec.nm = 0;
+	rec.bx = NULL;
+	rec.l_bx = 0;
+	while (q + 3 <= end) {
+		char tag0 = q[0], tag1 = q[1], type = q[2];
+		q += 3;
+		size_t size = 0;
+		switch (type) {
+		  case 'A': case 'c': case 'C': size = 1; break;
+		  case 's': case 'S': size = 2; break;
+		  case 'i': case 'I': case 'f': size = 4; break;
+		  case 'Z': case 'H': {
+			const char* nul = static_cast<const char*>(
+					memchr(q, '\0', end - q));
+			if (nul == NULL)
+				die("invalid auxiliary field");
+			if (tag0 == 'B' && tag1 == 'X' && type == 'Z'
+					&& rec.bx == NULL) {
+				rec.bx = q;
+				rec.l_bx = nul - q;
+			}
+			q = nul + 1;
+			continue;
+		  }
+		  case 'B': {
+			if (q + 5 > end)
+				die("invalid auxiliary field");
+			char subtype = q[0];
+			size_t count = getLE32(q + 1);
+			size_t elem = subtype == 'c' || subtype == 'C' ? 1
+				: subtype == 's' || subtype == 'S' ? 2 : 4;
+			q += 5;
+			if (count > size_t(end - q) / elem)
+				die("invalid auxiliary field");
+			q += count * elem;
+			continue;
+		  }
+		  default:
+			die("invalid auxiliary field");
+		}
+		if (q + size > end)
+			die("invalid auxiliary field");
+		if (tag0 == 'N' && tag1 == 'M') {
+			switch (type) {
+			  case 'c': rec.nm = int8_t(q[0]); break;
+			  case 'C': rec.nm = uint8_t(q[0]); break;
+			  case 's': rec.nm = int16_t(getLE16(q)); break;
+			  case 'S': rec.nm = getLE16(q); break;
+			  case 'i': case 'I': rec.nm = int32_t(getLE32(q)); break;
+			}
+		}
+		q += size;
+	}
+	return true;
+}
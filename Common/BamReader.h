@@ -0,0 +1,104 @@
+#ifndef BAMREADER_H
+#define BAMREADER_H 1
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * A BAM alignment record. The pointers refer to the decompressed
+ * buffer of the BamReader and are valid until the next call to
+ * BamReader::read.
+ */
+struct BamRecord
+{
+	/** reference sequence index, or -1 if unmapped */
+	int32_t refID;
+	/** 0-based leftmost position, or -1 if unmapped */
+	int32_t pos;
+	uint16_t flag;
+	uint8_t mapq;
+	/** length of the query sequence (SEQ) */
+	int32_t l_seq;
+	/** reference sequence index of the mate, or -1 if unmapped */
+	int32_t next_refID;
+	/** 0-based leftmost position of the mate, or -1 if unmapped */
+	int32_t next_pos;
+	/** NUL-terminated read name */
+	const char* readName;
+	uint16_t n_cigar_op;
+	/** number of aligned query bases (CIGAR operations M, I, = and X) */
+	int32_t qalen;
+	/** value of the NM tag, or 0 if not present */
+	int32_t nm;
+	/** value of the BX tag (not NUL-terminated), or NULL if not present */
+	const char* bx;
+	size_t l_bx;
+
+	/** CIGAR operations, encoded as len<<4|op (may be unaligned) */
+	const char* cigarData;
+
+	/** Return the CIGAR operation at index i. */
+	uint32_t cigar(unsigned i) const;
+};
+
+/**
+ * Read a BAM file. The BGZF blocks are decompressed in batches
+ * using multiple threads, and the alignment records are decoded
+ * in place without formatting them as SAM text.
+ */
+class BamReader
+{
+public:
+	/** A reference sequence name and length. */
+	typedef std::pair<std::string, int> Reference;
+
+	BamReader(const std::string& path, unsigned threads);
+	~BamReader();
+
+	/** Return the SAM header text. */
+	const std::string& headerText() const { return m_text; }
+
+	/** Return the reference sequences listed in the header. */
+	const std::vector<Reference>& references() const { return m_refs; }
+
+	/** Read the next alignment record. Return false at end of file. */
+	bool read(BamRecord& rec);
+
+private:
+	BamReader(const BamReader&);
+	BamReader& operator=(const BamReader&);
+
+	/** Ensure that n decompressed bytes are available.
+	 * Return false if end of file is reached first. */
+	bool fill(size_t n);
+
+	/** Read and decompress the next batch of BGZF blocks. */
+	bool readBlocks();
+
+	/** Copy n decompressed bytes to dest. */
+	void readBytes(void* dest, size_t n);
+
+	/** Exit with an error message. */
+	void die(const std::string& msg) const;
+
+	std::string m_path;
+	FILE* m_in;
+	unsigned m_threads;
+
+	/** compressed blocks of the current batch */
+	std::vector<unsigned char> m_blocks;
+	std::vector<size_t> m_blockStart;
+	std::vector<size_t> m_cdataStart;
+
+	/** decompressed data and current read position */
+	std::vector<char> m_buf;
+	size_t m_pos;
+
+	std::string m_text;
+	std::vector<Reference> m_refs;
+};
+
+#endif
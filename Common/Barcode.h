@@ -0,0 +1,159 @@
+#ifndef BARCODE_H
+#define BARCODE_H 1
+
+#include <cassert>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A barcode encoded as a 64-bit integer. A barcode of at most 27
+ * nucleotides ACGT with an optional suffix -N, where N is 1 to 255,
+ * is packed in 2 bits per nucleotide, preceded by a sentinel bit that
+ * records its length, and followed by 8 bits of suffix. Any other
+ * barcode is numbered by a BarcodeDictionary and has its top bit set.
+ * The value 0 is not a barcode.
+ */
+typedef uint64_t BarcodeKey;
+
+/** The value of a missing barcode */
+static const BarcodeKey NO_BARCODE = 0;
+
+/** The top bit, which is set for barcodes that are not packed */
+static const BarcodeKey BARCODE_NOT_PACKED = BarcodeKey(1) << 63;
+
+/** The maximum number of nucleotides of a packed barcode */
+static const size_t MAX_PACKED_BARCODE = 27;
+
+/** Return true if the barcode is packed. */
+static inline bool isPackedBarcode(BarcodeKey key)
+{
+	return key != NO_BARCODE && (key & BARCODE_NOT_PACKED) == 0;
+}
+
+/** Pack the barcode s of length n.
+ * @return NO_BARCODE if the barcode cannot be packed
+ */
+static inline BarcodeKey packBarcode(const char* s, size_t n)
+{
+	// Parse the suffix -N.
+	unsigned suffix = 0;
+	size_t dash = n;
+	while (dash > 0 && s[dash - 1] >= '0' && s[dash - 1] <= '9')
+		--dash;
+	if (dash > 0 && dash < n && s[dash - 1] == '-' && s[dash] != '0'
+			&& n - dash <= 3) {
+		for (size_t i = dash; i < n; ++i)
+			suffix = 10 * suffix + (s[i] - '0');
+		if (suffix > 255)
+			return NO_BARCODE;
+		n = dash - 1;
+	}
+
+	if (n == 0 || n > MAX_PACKED_BARCODE)
+		return NO_BARCODE;
+	BarcodeKey bits = 1;
+	for (size_t i = 0; i < n; ++i) {
+		unsigned x;
+		switch (s[i]) {
+		  case 'A': x = 0; break;
+		  case 'C': x = 1; break;
+		  case 'G': x = 2; break;
+		  case 'T': x = 3; break;
+		  default: return NO_BARCODE;
+		}
+		bits = bits << 2 | x;
+	}
+	return bits << 8 | suffix;
+}
+
+/** Unpack a packed barcode. */
+static inline std::string unpackBarcode(BarcodeKey key)
+{
+	assert(isPackedBarcode(key));
+	static const char ACGT[] = "ACGT";
+	unsigned suffix = key & 0xff;
+	BarcodeKey bits = key >> 8;
+	size_t n = 0;
+	while (bits >> 2 * (n + 1) != 0)
+		++n;
+	std::string s(n, 'N');
+	for (size_t i = n; i > 0; --i, bits >>= 2)
+		s[i - 1] = ACGT[bits & 3];
+	if (suffix > 0) {
+		s += '-';
+		if (suffix >= 100)
+			s += char('0' + suffix / 100);
+		if (suffix >= 10)
+			s += char('0' + suffix / 10 % 10);
+		s += char('0' + suffix % 10);
+	}
+	return s;
+}
+
+/** Hash a barcode key. The packed bits are mixed, because the low
+ * bits of a packed barcode are the suffix, which rarely varies.
+ */
+struct HashBarcode
+{
+	size_t operator()(BarcodeKey key) const
+	{
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ULL;
+		key ^= key >> 33;
+		return key;
+	}
+};
+
+/**
+ * Encode barcodes as BarcodeKey. The barcodes that cannot be packed
+ * are numbered in the order in which they are first seen.
+ * Encoding is thread safe. Decoding is not safe while encoding.
+ */
+class BarcodeDictionary
+{
+public:
+	/** Encode the barcode s of length n, which must not be empty. */
+	BarcodeKey encode(const char* s, size_t n)
+	{
+		assert(n > 0);
+		BarcodeKey key = packBarcode(s, n);
+		if (key != NO_BARCODE)
+			return key;
+		std::string name(s, n);
+#pragma omp critical(BarcodeDictionary)
+		{
+			std::pair<Map::iterator, bool> inserted = m_map.insert(
+					Map::value_type(name, m_names.size()));
+			if (inserted.second)
+				m_names.push_back(name);
+			key = BARCODE_NOT_PACKED | inserted.first->second;
+		}
+		return key;
+	}
+
+	/** Decode a barcode. */
+	std::string decode(BarcodeKey key) const
+	{
+		assert(key != NO_BARCODE);
+		if (isPackedBarcode(key))
+			return unpackBarcode(key);
+		size_t i = key & ~BARCODE_NOT_PACKED;
+		assert(i < m_names.size());
+		return m_names[i];
+	}
+
+	/** Return the number of barcodes that are not packed. */
+	size_t size() const { return m_names.size(); }
+
+private:
+	typedef std::unordered_map<std::string, size_t> Map;
+	Map m_map;
+	std::vector<std::string> m_names;
+};
+
+#endif
@@ -68,6 +68,18 @@ class Dictionary
 			return it->second;
 		}
 
+		/** Find the index of the specified name.
+		 * @return false if the name is not in this dictionary
+		 */
+		bool find(const name_type& name, index_type& index) const
+		{
+			Map::const_iterator it = m_map.find(name);
+			if (it == m_map.end())
+				return false;
+			index = it->second;
+			return true;
+		}
+
 		/** Return the name of the specified index. */
 		name_reference getName(index_type index) const
 		{
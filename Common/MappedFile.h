@@ -0,0 +1,68 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H 1
+
+#include <cstddef>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** A read-only memory mapping of a regular file. */
+class MappedFile
+{
+public:
+	MappedFile() : m_data(NULL), m_size(0) { }
+	~MappedFile() { close(); }
+
+	/** Map the specified file into memory.
+	 * @return false if the file is not a non-empty regular file,
+	 * or if it cannot be mapped
+	 */
+	bool open(const std::string& path)
+	{
+		close();
+		// Passing the mode explicitly bypasses the uncompress hook
+		// of open, which handles the mode ios::in only.
+		int fd = ::open(path.c_str(), O_RDONLY, 0);
+		if (fd == -1)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)
+				|| st.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+		void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		madvise(p, st.st_size, MADV_SEQUENTIAL);
+		m_data = static_cast<const char*>(p);
+		m_size = st.st_size;
+		return true;
+	}
+
+	/** Unmap the file. */
+	void close()
+	{
+		if (m_data != NULL)
+			munmap(const_cast<char*>(m_data), m_size);
+		m_data = NULL;
+		m_size = 0;
+	}
+
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+	const char* begin() const { return m_data; }
+	const char* end() const { return m_data + m_size; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char* m_data;
+	size_t m_size;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef MINHASH_H
+#define MINHASH_H 1
+
+/**
+ * MinHash sketches of sets of integers. A sketch of size k records,
+ * for each of k hash functions, the minimum hash value of the
+ * elements of the set. The fraction of equal entries of two sketches
+ * estimates the Jaccard index of the two sets.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/** The value of a sketch entry of the empty set */
+static const uint32_t EMPTY_MINHASH = std::numeric_limits<uint32_t>::max();
+
+/** Mix the bits of x (the finalizer of MurmurHash3). */
+static inline uint64_t mixBits(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/** Return hash function i of the element x. */
+static inline uint32_t minHash(uint64_t x, unsigned i)
+{
+	return uint32_t(mixBits(x + (uint64_t(i) + 1) * 0x9e3779b97f4a7c15ULL));
+}
+
+/** Initialize a sketch of size k to the empty set. */
+static inline void clearSketch(uint32_t* sketch, unsigned k)
+{
+	for (unsigned i = 0; i < k; ++i)
+		sketch[i] = EMPTY_MINHASH;
+}
+
+/** Add the element x to a sketch of size k. */
+static inline void addToSketch(uint32_t* sketch, unsigned k, uint64_t x)
+{
+	for (unsigned i = 0; i < k; ++i) {
+		uint32_t h = minHash(x, i);
+		if (h < sketch[i])
+			sketch[i] = h;
+	}
+}
+
+/** Estimate the Jaccard index of the sets of two sketches of size k. */
+static inline double estimateJaccard(
+		const uint32_t* a, const uint32_t* b, unsigned k)
+{
+	assert(k > 0);
+	unsigned equal = 0;
+	for (unsigned i = 0; i < k; ++i)
+		equal += a[i] == b[i] && a[i] != EMPTY_MINHASH;
+	return double(equal) / k;
+}
+
+/**
+ * Return the key of a band of r entries of a sketch, for locality
+ * sensitive hashing. Two sets with Jaccard index J have equal keys
+ * for one band with probability about J^r.
+ */
+static inline uint64_t sketchBandKey(const uint32_t* band, unsigned r)
+{
+	uint64_t key = r;
+	for (unsigned i = 0; i < r; ++i)
+		key = mixBits(key * 0x9e3779b97f4a7c15ULL + band[i]);
+	return key;
+}
+
+/** The key of a pair of sets that is not a candidate */
+static const uint64_t NO_PAIR = std::numeric_limits<uint64_t>::max();
+
+/**
+ * Find the candidate pairs of similar sets by locality sensitive
+ * hashing. The n sketches of size k are divided into k / r bands of r
+ * entries, and two sets whose keys are equal for some band are a
+ * candidate. The function pairKey(x, y), of the sets x < y, returns the
+ * key of the candidate, or NO_PAIR to skip it. The sets that share a
+ * band key are skipped when there are more than maxBucket of them, and
+ * their number is added to skipped. The bands are processed in
+ * parallel, and their candidates are merged after each round of bands.
+ * @return the sorted distinct keys of the candidates
+ */
+template <typename PairKey>
+static inline std::vector<uint64_t> findCandidatePairs(
+		const uint32_t* sketches, size_t n, unsigned k, unsigned r,
+		size_t maxBucket, unsigned threads, const PairKey& pairKey,
+		size_t& skipped)
+{
+	assert(r > 0 && k % r == 0);
+	assert(n <= std::numeric_limits<uint32_t>::max());
+	const unsigned numBands = k / r;
+	if (threads == 0)
+		threads = 1;
+
+	std::vector<uint64_t> pairs, merged;
+	size_t numSkipped = 0;
+	std::vector<std::vector<uint64_t>> round(std::min(threads, numBands));
+	for (unsigned first = 0; first < numBands; first += round.size()) {
+		const unsigned last = std::min<unsigned>(numBands, first + round.size());
+#pragma omp parallel for num_threads(round.size()) schedule(dynamic, 1) reduction(+:numSkipped)
+		for (unsigned band = first; band < last; ++band) {
+			std::vector<std::pair<uint64_t, uint32_t>> keys;
+			for (size_t x = 0; x < n; ++x)
+				if (sketches[x * k] != EMPTY_MINHASH)
+					keys.push_back(std::make_pair(
+						sketchBandKey(&sketches[x * k + band * r], r), x));
+			std::sort(keys.begin(), keys.end());
+
+			std::vector<uint64_t>& out = round[band - first];
+			for (size_t i = 0, j; i < keys.size(); i = j) {
+				for (j = i + 1; j < keys.size() && keys[j].first == keys[i].first; ++j)
+					;
+				if (j - i > maxBucket) {
+					numSkipped += j - i;
+					continue;
+				}
+				for (size_t x = i; x < j; ++x) {
+					for (size_t y = x + 1; y < j; ++y) {
+						uint64_t key = pairKey(keys[x].second, keys[y].second);
+						if (key != NO_PAIR)
+							out.push_back(key);
+					}
+				}
+			}
+			std::sort(out.begin(), out.end());
+			out.erase(std::unique(out.begin(), out.end()), out.end());
+		}
+
+		for (unsigned band = first; band < last; ++band) {
+			std::vector<uint64_t>& out = round[band - first];
+			merged.clear();
+			merged.reserve(pairs.size() + out.size());
+			std::set_union(pairs.begin(), pairs.end(), out.begin(), out.end(),
+					std::back_inserter(merged));
+			pairs.swap(merged);
+			std::vector<uint64_t>().swap(out);
+		}
+	}
+	skipped += numSkipped;
+	return pairs;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef OUTPUTBUFFER_H
+#define OUTPUTBUFFER_H 1
+
+/**
+ * Buffered text output. Text is appended to a reusable buffer, which
+ * is written to its stream when it is full. Integers are formatted
+ * without iostreams. Blocks of output may be formatted in parallel
+ * into their own buffers and written in order.
+ */
+
+#include "Common/StringUtil.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+
+/** The maximum number of characters of a formatted 64-bit integer */
+static const size_t MAX_INTEGER_CHARS = 20;
+
+/** Write the decimal digits of x to p and return the end, like
+ * std::to_chars. p must have room for MAX_INTEGER_CHARS characters.
+ */
+static inline char* formatUnsigned(char* p, uint64_t x)
+{
+	static const char DIGITS[] =
+		"00010203040506070809101112131415161718192021222324"
+		"25262728293031323334353637383940414243444546474849"
+		"50515253545556575859606162636465666768697071727374"
+		"75767778798081828384858687888990919293949596979899";
+	char buf[MAX_INTEGER_CHARS];
+	char* q = buf + MAX_INTEGER_CHARS;
+	while (x >= 100) {
+		const char* d = &DIGITS[2 * (x % 100)];
+		x /= 100;
+		*--q = d[1];
+		*--q = d[0];
+	}
+	if (x >= 10) {
+		const char* d = &DIGITS[2 * x];
+		*--q = d[1];
+		*--q = d[0];
+	} else
+		*--q = char('0' + x);
+	return std::copy(q, buf + MAX_INTEGER_CHARS, p);
+}
+
+/** Write the decimal digits of x to p and return the end. */
+static inline char* formatInteger(char* p, int64_t x)
+{
+	if (x >= 0)
+		return formatUnsigned(p, x);
+	*p++ = '-';
+	return formatUnsigned(p, -uint64_t(x));
+}
+
+/**
+ * A text buffer. A buffer of a stream writes its text to the stream
+ * when it reaches CAPACITY and when it is flushed or destroyed. A
+ * buffer without a stream collects text until it is cleared.
+ */
+class OutputBuffer
+{
+  public:
+	/** The size at which a buffer is written to its stream */
+	static const size_t CAPACITY = 1 << 20;
+
+	explicit OutputBuffer(std::ostream* out = NULL) : m_out(out)
+	{
+		if (m_out != NULL)
+			m_buf.reserve(CAPACITY + MAX_INTEGER_CHARS);
+	}
+
+	~OutputBuffer() { flush(); }
+
+	/** Append n characters. */
+	void append(const char* s, size_t n)
+	{
+		m_buf.append(s, n);
+		maybeFlush();
+	}
+
+	OutputBuffer& operator<<(char c)
+	{
+		m_buf.push_back(c);
+		maybeFlush();
+		return *this;
+	}
+
+	OutputBuffer& operator<<(const char* s)
+	{
+		append(s, strlen(s));
+		return *this;
+	}
+
+	OutputBuffer& operator<<(const std::string& s)
+	{
+		append(s.data(), s.size());
+		return *this;
+	}
+
+	OutputBuffer& operator<<(const StringRef& s)
+	{
+		append(s.data, s.size);
+		return *this;
+	}
+
+	OutputBuffer& operator<<(int x) { return appendInteger(x); }
+	OutputBuffer& operator<<(long x) { return appendInteger(x); }
+	OutputBuffer& operator<<(long long x) { return appendInteger(x); }
+	OutputBuffer& operator<<(unsigned x) { return appendUnsigned(x); }
+	OutputBuffer& operator<<(unsigned long x) { return appendUnsigned(x); }
+	OutputBuffer& operator<<(unsigned long long x) { return appendUnsigned(x); }
+
+	/** Return the text that has not been written. */
+	const std::string& str() const { return m_buf; }
+
+	/** Discard the text that has not been written. */
+	void clear() { m_buf.clear(); }
+
+	/** Write the text to a stream and clear it. */
+	void writeTo(std::ostream& out)
+	{
+		out.write(m_buf.data(), m_buf.size());
+		m_buf.clear();
+	}
+
+	/** Write the text to the stream of this buffer. */
+	void flush()
+	{
+		if (m_out != NULL && !m_buf.empty())
+			writeTo(*m_out);
+	}
+
+  private:
+	OutputBuffer(const OutputBuffer&);
+	OutputBuffer& operator=(const OutputBuffer&);
+
+	OutputBuffer& appendInteger(int64_t x)
+	{
+		char buf[MAX_INTEGER_CHARS];
+		append(buf, formatInteger(buf, x) - buf);
+		return *this;
+	}
+
+	OutputBuffer& appendUnsigned(uint64_t x)
+	{
+		char buf[MAX_INTEGER_CHARS];
+		append(buf, formatUnsigned(buf, x) - buf);
+		return *this;
+	}
+
+	void maybeFlush()
+	{
+		if (m_out != NULL && m_buf.size() >= CAPACITY)
+			writeTo(*m_out);
+	}
+
+	std::ostream* m_out;
+	std::string m_buf;
+};
+
+/** The number of items of a block of writeBlocks */
+static const size_t OUTPUT_BLOCK_SIZE = 4096;
+
+/**
+ * Write the items [0, n) to a stream. Blocks of items are formatted
+ * in parallel by format(buffer, i), and the blocks are written in
+ * order, so the output does not depend on the number of threads.
+ */
+template <typename Format>
+static inline void writeBlocks(std::ostream& out, size_t n,
+		unsigned threads, const Format& format)
+{
+	if (threads == 0)
+		threads = 1;
+	const size_t numBlocks = (n + OUTPUT_BLOCK_SIZE - 1) / OUTPUT_BLOCK_SIZE;
+#pragma omp parallel num_threads(threads)
+	{
+		OutputBuffer block;
+#pragma omp for ordered schedule(dynamic, 1)
+		for (size_t b = 0; b < numBlocks; ++b) {
+			size_t last = std::min(n, (b + 1) * OUTPUT_BLOCK_SIZE);
+			for (size_t i = b * OUTPUT_BLOCK_SIZE; i < last; ++i)
+				format(block, i);
+#pragma omp ordered
+			block.writeTo(out);
+		}
+	}
+}
+
+#endif
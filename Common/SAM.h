@@ -1,25 +1,127 @@
 #ifndef SAM_H
 #define SAM_H 1
 
+#include "Common/StringUtil.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <string>
+#include <vector>
 
-/** Extract the specified SAM tag from a string.
+/**
+ * The fields of a SAM alignment record. The string fields refer to
+ * the SAM line, which must outlive this record.
+ */
+struct SAMRecord
+{
+    StringRef qname;
+    int flag;
+    StringRef rname;
+    int pos;
+    int mapq;
+    StringRef cigar;
+    StringRef rnext;
+    int pnext;
+    int tlen;
+    StringRef seq;
+    StringRef qual;
+    /** the optional fields (tags), separated by tabs */
+    StringRef tags;
+};
+
+/** Parse a decimal integer, which may be negative.
+ * Parsing stops at the first character that is not a digit.
+ */
+static inline int parseSAMInt(const StringRef& s)
+{
+    const char* p = s.begin();
+    bool negative = p != s.end() && *p == '-';
+    if (negative)
+        ++p;
+    int x = 0;
+    for (; p != s.end() && *p >= '0' && *p <= '9'; ++p)
+        x = 10 * x + (*p - '0');
+    return negative ? -x : x;
+}
+
+/**
+ * Split a line of SAM text into its fields without copying them.
+ * Missing fields are empty or zero.
+ * @return false if the line has fewer than 11 fields
+ */
+static inline bool parseSAMRecord(const char* line, size_t length, SAMRecord& rec)
+{
+    StringRef fields[11];
+    const char* p = line;
+    const char* end = line + length;
+    unsigned n = 0;
+    for (; n < 11 && p != end; ++n) {
+        const char* tab = static_cast<const char*>(memchr(p, '\t', end - p));
+        const char* fieldEnd = tab != NULL ? tab : end;
+        fields[n] = StringRef(p, fieldEnd - p);
+        p = tab != NULL ? tab + 1 : end;
+    }
+
+    rec.qname = fields[0];
+    rec.flag = parseSAMInt(fields[1]);
+    rec.rname = fields[2];
+    rec.pos = parseSAMInt(fields[3]);
+    rec.mapq = parseSAMInt(fields[4]);
+    rec.cigar = fields[5];
+    rec.rnext = fields[6];
+    rec.pnext = parseSAMInt(fields[7]);
+    rec.tlen = parseSAMInt(fields[8]);
+    rec.seq = fields[9];
+    rec.qual = fields[10];
+    rec.tags = StringRef(p, end - p);
+    return n == 11;
+}
+
+/** Find the value of the specified SAM tag without copying it.
  * @param tag the SAM tag, including two colons, for example "BX:Z:"
+ * @return the value, or an empty string if the tag is not found
  */
 template <size_t N>
-static inline std::string parseSAMTag(const std::string& s, const char (&tag)[N])
+static inline StringRef findSAMTag(const StringRef& s, const char (&tag)[N])
 {
-    size_t start = s.find(tag);
-    if (start == std::string::npos)
-        return std::string();
+    const char* start = std::search(s.begin(), s.end(), tag, tag + N - 1);
+    if (start == s.end())
+        return StringRef();
     start += N - 1;
 
     // Find the next whitespace or EOL after "BX:Z:".
-    size_t end = s.find_first_of(" \t\r\n", start);
-    if (end == std::string::npos)
-        end = s.length();
+    static const char space[] = " \t\r\n";
+    const char* end = std::find_first_of(start, s.end(), space, space + 4);
+    return StringRef(start, end - start);
+}
+
+/** Extract the specified SAM tag from a string.
+ * @param tag the SAM tag, including two colons, for example "BX:Z:"
+ */
+template <size_t N>
+static inline std::string parseSAMTag(const std::string& s, const char (&tag)[N])
+{
+    return findSAMTag(StringRef(s), tag).str();
+}
 
-    return s.substr(start, end - start);
+/**
+ * Return the number of query bases aligned by a CIGAR string,
+ * which is the total length of its M, I, = and X operations.
+ */
+static inline int cigarQueryLength(const StringRef& cigar)
+{
+    int qalen = 0;
+    int length = 0;
+    for (const char* p = cigar.begin(); p != cigar.end(); ++p) {
+        if (*p >= '0' && *p <= '9') {
+            length = 10 * length + (*p - '0');
+        } else {
+            if (*p == 'M' || *p == 'I' || *p == '=' || *p == 'X')
+                qalen += length;
+            length = 0;
+        }
+    }
+    return qalen;
 }
 
 /**
@@ -32,4 +134,73 @@ static inline std::string parseBXTag(const std::string& s)
     return parseSAMTag(s, "BX:Z:");
 }
 
+/** Return the line that begins at p, without its newline. */
+static inline StringRef getLine(const char* p, const char* end)
+{
+    const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+    return StringRef(p, (nl != NULL ? nl : end) - p);
+}
+
+/** Return the read name (QNAME) of a line of SAM text. */
+static inline StringRef getReadName(const StringRef& line)
+{
+    const char* tab = static_cast<const char*>(memchr(line.data, '\t', line.size));
+    return StringRef(line.data, (tab != NULL ? tab : line.end()) - line.data);
+}
+
+/*
+ * Return the start of the first line at or after p whose read name
+ * differs from that of the preceding line, so that the alignments of
+ * a read are not split between two parts.
+ */
+static const char* nextReadBoundary(const char* begin, const char* p, const char* end)
+{
+    assert(begin < p);
+    // Move to the start of a line.
+    while (p != end && p[-1] != '\n')
+        ++p;
+    if (p == end)
+        return end;
+
+    // Find the start of the preceding line.
+    const char* prev = p - 1;
+    while (prev != begin && prev[-1] != '\n')
+        --prev;
+    StringRef prevName = getReadName(getLine(prev, end));
+
+    while (p != end) {
+        StringRef line = getLine(p, end);
+        StringRef name = getReadName(line);
+        if (name != prevName)
+            break;
+        prevName = name;
+        p = line.end() == end ? end : line.end() + 1;
+    }
+    return p;
+}
+
+/*
+ * Split the SAM alignments [body, end) of the text that begins at
+ * begin into at most numParts parts, at read boundaries. Return the
+ * bounds of the parts, the first of which is body and the last end.
+ * A part ends before end only at the start of a read, so that only
+ * the last part ends with the end of the text.
+ */
+static inline std::vector<const char*> splitSAMText(const char* begin,
+        const char* body, const char* end, size_t numParts)
+{
+    std::vector<const char*> bounds(1, body);
+    for (size_t i = 1; i < numParts; ++i) {
+        const char* p = body + (end - body) * i / numParts;
+        if (p <= bounds.back())
+            continue;
+        const char* bound = nextReadBoundary(begin, p, end);
+        if (bound == end)
+            break;
+        bounds.push_back(bound);
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
 #endif
@@ -0,0 +1,152 @@
+#ifndef SETINTERSECT_H
+#define SETINTERSECT_H 1
+
+/**
+ * Count the elements shared by two sorted arrays of distinct 32-bit
+ * integers. Blocks of the two arrays are compared all-against-all
+ * using SSE2 or AVX2 when available, with a scalar fallback. When one
+ * array is much smaller than the other, its elements are found in the
+ * larger array by galloping search instead.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <stdint.h>
+#if __AVX2__
+# include <immintrin.h>
+#elif __SSE2__
+# include <emmintrin.h>
+#endif
+
+/** The ratio of sizes above which galloping search is used */
+static const size_t GALLOP_RATIO = 32;
+
+/** Count the shared elements by merging. */
+static inline size_t countIntersectionScalar(
+		const uint32_t* a, size_t na, const uint32_t* b, size_t nb)
+{
+	size_t count = 0;
+	size_t i = 0, j = 0;
+	while (i < na && j < nb) {
+		if (a[i] < b[j]) {
+			++i;
+		} else if (b[j] < a[i]) {
+			++j;
+		} else {
+			++count;
+			++i;
+			++j;
+		}
+	}
+	return count;
+}
+
+/** Count the shared elements by searching the larger array b
+ * for each element of the smaller array a. */
+static inline size_t countIntersectionGalloping(
+		const uint32_t* a, size_t na, const uint32_t* b, size_t nb)
+{
+	size_t count = 0;
+	const uint32_t* first = b;
+	const uint32_t* last = b + nb;
+	for (size_t i = 0; i < na && first != last; ++i) {
+		// Find a range that contains a[i] by doubling the step.
+		size_t step = 1;
+		const uint32_t* hi = first;
+		while (hi < last && *hi < a[i]) {
+			first = hi;
+			hi = size_t(last - hi) > step ? hi + step : last;
+			step *= 2;
+		}
+		first = std::lower_bound(first, hi, a[i]);
+		if (first != last && *first == a[i]) {
+			++count;
+			++first;
+		}
+	}
+	return count;
+}
+
+#if __AVX2__
+
+/** Count the shared elements, comparing blocks of 8 with AVX2. */
+static inline size_t countIntersectionSIMD(
+		const uint32_t* a, size_t na, const uint32_t* b, size_t nb)
+{
+	const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+	size_t count = 0;
+	size_t i = 0, j = 0;
+	while (i + 8 <= na && j + 8 <= nb) {
+		__m256i va = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(a + i));
+		__m256i vb = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(b + j));
+		__m256i match = _mm256_cmpeq_epi32(va, vb);
+		for (unsigned k = 1; k < 8; ++k) {
+			vb = _mm256_permutevar8x32_epi32(vb, rotate);
+			match = _mm256_or_si256(match, _mm256_cmpeq_epi32(va, vb));
+		}
+		count += __builtin_popcount(
+				_mm256_movemask_ps(_mm256_castsi256_ps(match)));
+		uint32_t amax = a[i + 7], bmax = b[j + 7];
+		if (amax <= bmax)
+			i += 8;
+		if (bmax <= amax)
+			j += 8;
+	}
+	return count + countIntersectionScalar(a + i, na - i, b + j, nb - j);
+}
+
+#elif __SSE2__
+
+/** Count the shared elements, comparing blocks of 4 with SSE2. */
+static inline size_t countIntersectionSIMD(
+		const uint32_t* a, size_t na, const uint32_t* b, size_t nb)
+{
+	size_t count = 0;
+	size_t i = 0, j = 0;
+	while (i + 4 <= na && j + 4 <= nb) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+		__m128i match = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi32(va, vb),
+					_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39))),
+				_mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4e)),
+					_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93))));
+		count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(match)));
+		uint32_t amax = a[i + 3], bmax = b[j + 3];
+		if (amax <= bmax)
+			i += 4;
+		if (bmax <= amax)
+			j += 4;
+	}
+	return count + countIntersectionScalar(a + i, na - i, b + j, nb - j);
+}
+
+#else
+
+static inline size_t countIntersectionSIMD(
+		const uint32_t* a, size_t na, const uint32_t* b, size_t nb)
+{
+	return countIntersectionScalar(a, na, b, nb);
+}
+
+#endif
+
+/** Return the number of elements shared by the sorted arrays a and b,
+ * whose elements are distinct. */
+static inline size_t countIntersection(
+		const uint32_t* a, size_t na, const uint32_t* b, size_t nb)
+{
+	if (na > nb) {
+		std::swap(a, b);
+		std::swap(na, nb);
+	}
+	if (na == 0)
+		return 0;
+	if (nb / na >= GALLOP_RATIO)
+		return countIntersectionGalloping(a, na, b, nb);
+	return countIntersectionSIMD(a, na, b, nb);
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <limits>
+#include <vector>
 
 /** compute the qth quantile, where `q` is in the range [0,1] */
 template <class IteratorT>
@@ -31,4 +33,71 @@ static inline double quantile(IteratorT it1, IteratorT it2, double q)
 	return weight * before + (1.0 - weight) * after;
 }
 
+/** Normal approximation to the binomial distribution */
+static inline float normalEstimation(int x, float p, int n)
+{
+	float mean = n * p;
+	float sd = std::sqrt(n * p * (1 - p));
+	return 0.5 * (1 + std::erf((x - mean)/(sd * std::sqrt(2))));
+}
+
+/**
+ * Critical values of the one-sided test that x is significantly large,
+ * which passes when 1 - normalEstimation(x, p, n) < alpha. For each n
+ * up to a bound, the table stores the least x that passes, so that the
+ * test is one comparison. Larger n fall back to the formula.
+ */
+class BinomialCriticalValues
+{
+public:
+	BinomialCriticalValues(float p, float alpha, unsigned maxN = 4096)
+		: m_p(p), m_alpha(alpha), m_min(maxN + 1)
+	{
+		for (unsigned n = 0; n <= maxN; ++n) {
+			// The test is monotonic in x. An x this far above the mean
+			// passes unless no x does.
+			int lo = 0;
+			int hi = int(n * p + 10 * std::sqrt(n * p * (1 - p))) + 10;
+			if (!passes(hi, n)) {
+				m_min[n] = std::numeric_limits<int>::max();
+				continue;
+			}
+			while (lo < hi) {
+				int mid = lo + (hi - lo) / 2;
+				if (passes(mid, n))
+					hi = mid;
+				else
+					lo = mid + 1;
+			}
+			m_min[n] = lo;
+		}
+	}
+
+	/** Return whether x of n is significant. */
+	bool significant(int x, int n) const
+	{
+		if (n >= 0 && size_t(n) < m_min.size())
+			return x >= m_min[n];
+		return passes(x, n);
+	}
+
+	/** Return the least x of n that is significant,
+	 * or the maximum int if there is none. */
+	int minSignificant(unsigned n) const
+	{
+		assert(n < m_min.size());
+		return m_min[n];
+	}
+
+private:
+	bool passes(int x, int n) const
+	{
+		return 1 - normalEstimation(x, m_p, n) < m_alpha;
+	}
+
+	float m_p;
+	float m_alpha;
+	std::vector<int> m_min;
+};
+
 #endif
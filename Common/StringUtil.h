@@ -1,11 +1,45 @@
 #ifndef STRINGUTIL_H
 #define STRINGUTIL_H 1
 
+#include <algorithm>
 #include <cassert>
 #include <iomanip>
 #include <sstream>
 #include <string>
 
+/**
+ * A substring of a larger string. The characters are not copied,
+ * and the larger string must outlive this object.
+ */
+struct StringRef
+{
+	const char* data;
+	size_t size;
+
+	StringRef() : data(NULL), size(0) { }
+	StringRef(const char* data, size_t size) : data(data), size(size) { }
+	StringRef(const std::string& s) : data(s.data()), size(s.size()) { }
+
+	bool empty() const { return size == 0; }
+	const char* begin() const { return data; }
+	const char* end() const { return data + size; }
+
+	/** Return a copy of this substring. */
+	std::string str() const { return std::string(data, size); }
+};
+
+/** Return true if the two strings are equal. */
+static inline bool operator==(const StringRef& a, const StringRef& b)
+{
+	return a.size == b.size && std::equal(a.begin(), a.end(), b.begin());
+}
+
+/** Return true if the two strings differ. */
+static inline bool operator!=(const StringRef& a, const StringRef& b)
+{
+	return !(a == b);
+}
+
 /** Return the last character of s and remove it. */
 static inline char chop(std::string& s)
 {
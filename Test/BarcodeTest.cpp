@@ -0,0 +1,55 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/Barcode.h"
+
+using namespace std;
+
+TEST_CASE("packBarcode", "[Barcode]")
+{
+    const string bx("CGTCAGGTCAGAGGTG-1");
+    BarcodeKey key = packBarcode(bx.data(), bx.size());
+    REQUIRE(isPackedBarcode(key));
+    REQUIRE(unpackBarcode(key) == bx);
+
+    const string a("A"), aa("AA"), t("T");
+    REQUIRE(packBarcode(a.data(), a.size()) != packBarcode(aa.data(), aa.size()));
+    REQUIRE(unpackBarcode(packBarcode(aa.data(), aa.size())) == aa);
+    REQUIRE(unpackBarcode(packBarcode(t.data(), t.size())) == t);
+
+    const string suffix("ACGT-255");
+    REQUIRE(unpackBarcode(packBarcode(suffix.data(), suffix.size())) == suffix);
+
+    const string longest(MAX_PACKED_BARCODE, 'T');
+    REQUIRE(unpackBarcode(packBarcode(longest.data(), longest.size())) == longest);
+
+    const string tooLong(MAX_PACKED_BARCODE + 1, 'A');
+    const string lower("acgt"), n("ACNT"), zero("ACGT-0"), big("ACGT-256"), dash("-1");
+    REQUIRE(packBarcode(tooLong.data(), tooLong.size()) == NO_BARCODE);
+    REQUIRE(packBarcode(lower.data(), lower.size()) == NO_BARCODE);
+    REQUIRE(packBarcode(n.data(), n.size()) == NO_BARCODE);
+    REQUIRE(packBarcode(zero.data(), zero.size()) == NO_BARCODE);
+    REQUIRE(packBarcode(big.data(), big.size()) == NO_BARCODE);
+    REQUIRE(packBarcode(dash.data(), dash.size()) == NO_BARCODE);
+}
+
+TEST_CASE("BarcodeDictionary", "[Barcode]")
+{
+    BarcodeDictionary dict;
+    const string packed("ACGT-1"), other("acgt"), other2("ACNT-1");
+
+    BarcodeKey key = dict.encode(packed.data(), packed.size());
+    REQUIRE(isPackedBarcode(key));
+    REQUIRE(dict.size() == 0);
+
+    BarcodeKey key1 = dict.encode(other.data(), other.size());
+    BarcodeKey key2 = dict.encode(other2.data(), other2.size());
+    REQUIRE(!isPackedBarcode(key1));
+    REQUIRE(key1 != key2);
+    REQUIRE(dict.encode(other.data(), other.size()) == key1);
+    REQUIRE(dict.size() == 2);
+
+    REQUIRE(dict.decode(key) == packed);
+    REQUIRE(dict.decode(key1) == other);
+    REQUIRE(dict.decode(key2) == other2);
+}
@@ -0,0 +1,129 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Arcs/DistanceEst.h"
+#include "Common/MapUtil.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+Dictionary g_contigNames;
+
+/** a Jaccard index and a distance */
+typedef vector<pair<double, unsigned>> Samples;
+
+/** Add a sample whose Jaccard index is intersect / union. */
+static void addSample(DistSampleMap& distSamples, Samples& samples,
+		unsigned intersect, unsigned union_, unsigned distance)
+{
+	DistSample sample;
+	sample.distance = distance;
+	sample.barcodesIntersect = intersect;
+	sample.barcodesUnion = union_;
+	distSamples.push_back(sample);
+	samples.push_back(make_pair(double(intersect) / union_, distance));
+}
+
+/**
+ * Return the estimate of the n samples closest to a Jaccard index,
+ * found by closestKeys. The samples are inserted in sorted order, so
+ * that the samples with equal Jaccard indices are in the order of the
+ * table.
+ */
+static DistanceEstimate closestEstimate(Samples samples, size_t n,
+		double jaccard)
+{
+	sort(samples.begin(), samples.end());
+	multimap<double, unsigned> jaccardToDist;
+	for (const auto& sample : samples)
+		jaccardToDist.insert(jaccardToDist.end(), sample);
+
+	typedef multimap<double, unsigned>::const_iterator It;
+	pair<It, It> range = closestKeys(jaccardToDist, jaccard, max<size_t>(1, n));
+	vector<unsigned> distances;
+	for (It it = range.first; it != range.second; ++it)
+		distances.push_back(it->second);
+	sort(distances.begin(), distances.end());
+	DistanceEstimate est;
+	est.minDist = (int)floor(
+		quantile(distances.begin(), distances.end(), 0.01));
+	est.dist = (int)round(
+		quantile(distances.begin(), distances.end(), 0.5));
+	est.maxDist = (int)ceil(
+		quantile(distances.begin(), distances.end(), 0.99));
+	return est;
+}
+
+/** Require the table to match closestEstimate at many Jaccard indices. */
+static void checkEstimates(const DistSampleMap& distSamples,
+		const Samples& samples, size_t n)
+{
+	ARCS::ArcsParams params;
+	params.dist_bin_size = n;
+	JaccardToDist table;
+	buildJaccardToDist(distSamples, params, table);
+	REQUIRE(table.size() == samples.size());
+
+	vector<double> queries;
+	for (unsigned i = 0; i <= 2000; ++i)
+		queries.push_back(i / 2000.0);
+	for (const auto& sample : samples)
+		queries.push_back(sample.first);
+	for (double jaccard : queries) {
+		DistanceEstimate est, expected = closestEstimate(samples, n, jaccard);
+		table.estimate(jaccard, est);
+		INFO("jaccard " << jaccard << " n " << n);
+		REQUIRE(est.minDist == expected.minDist);
+		REQUIRE(est.dist == expected.dist);
+		REQUIRE(est.maxDist == expected.maxDist);
+	}
+}
+
+TEST_CASE("JaccardToDist with repeated Jaccard indices", "[DistanceEst]")
+{
+	DistSampleMap distSamples;
+	Samples samples;
+	addSample(distSamples, samples, 1, 10, 100);
+	addSample(distSamples, samples, 1, 2, 900);
+	addSample(distSamples, samples, 1, 2, 900);
+	addSample(distSamples, samples, 1, 2, 900);
+
+	ARCS::ArcsParams params;
+	params.dist_bin_size = 2;
+	JaccardToDist table;
+	buildJaccardToDist(distSamples, params, table);
+	DistanceEstimate est;
+	// The closest window is {0.1, 0.5}, not {0.5, 0.5}.
+	table.estimate(0.1, est);
+	REQUIRE(est.dist == 500);
+	table.estimate(0.0, est);
+	REQUIRE(est.dist == 500);
+
+	for (size_t n = 1; n <= 5; ++n)
+		checkEstimates(distSamples, samples, n);
+}
+
+TEST_CASE("JaccardToDist matches closestKeys", "[DistanceEst]")
+{
+	srand(1);
+	for (unsigned trial = 0; trial < 20; ++trial) {
+		// Small denominators make many repeated indices and ties.
+		DistSampleMap distSamples;
+		Samples samples;
+		size_t numSamples = 1 + rand() % 200;
+		for (size_t i = 0; i < numSamples; ++i) {
+			unsigned union_ = 1 + rand() % 12;
+			addSample(distSamples, samples, rand() % (union_ + 1),
+					union_, 1000 + rand() % 100000);
+		}
+		const size_t sizes[] = { 1, 2, 3, 10, 20, 1000 };
+		for (size_t n : sizes)
+			checkEstimates(distSamples, samples, n);
+	}
+}
@@ -0,0 +1,119 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/MinHash.h"
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+TEST_CASE("MinHash Jaccard estimate", "[MinHash]")
+{
+	const unsigned k = 256;
+	vector<uint32_t> a(k), b(k), empty(k);
+	clearSketch(a.data(), k);
+	clearSketch(b.data(), k);
+	clearSketch(empty.data(), k);
+
+	// a = [0, 3000), b = [1000, 4000), so J = 2000 / 4000
+	for (uint64_t x = 0; x < 3000; ++x)
+		addToSketch(a.data(), k, x);
+	for (uint64_t x = 1000; x < 4000; ++x)
+		addToSketch(b.data(), k, x);
+
+	REQUIRE(fabs(estimateJaccard(a.data(), b.data(), k) - 0.5) < 0.1);
+	REQUIRE(estimateJaccard(a.data(), a.data(), k) == 1.0);
+	REQUIRE(estimateJaccard(a.data(), empty.data(), k) == 0.0);
+	REQUIRE(estimateJaccard(empty.data(), empty.data(), k) == 0.0);
+}
+
+TEST_CASE("MinHash band keys", "[MinHash]")
+{
+	const unsigned k = 8, r = 4;
+	vector<uint32_t> a(k), b(k);
+	clearSketch(a.data(), k);
+	clearSketch(b.data(), k);
+	addToSketch(a.data(), k, 42);
+	addToSketch(b.data(), k, 42);
+	REQUIRE(sketchBandKey(&a[0], r) == sketchBandKey(&b[0], r));
+	REQUIRE(sketchBandKey(&a[r], r) == sketchBandKey(&b[r], r));
+
+	addToSketch(b.data(), k, 7);
+	bool differ = false;
+	for (unsigned band = 0; band < k / r; ++band)
+		differ = differ
+			|| sketchBandKey(&a[band * r], r) != sketchBandKey(&b[band * r], r);
+	REQUIRE(differ == (a != b));
+}
+
+/** Return the candidate key of the sets x < y. */
+static uint64_t setPairKey(uint32_t x, uint32_t y)
+{
+	return uint64_t(x) << 32 | y;
+}
+
+TEST_CASE("MinHash candidate pair recall", "[MinHash]")
+{
+	// Sets 2p and 2p + 1 share 89 of 111 elements, so J = 0.8, and
+	// every other pair of sets is disjoint.
+	const unsigned k = 64, r = 4, numPairs = 500;
+	vector<uint32_t> sketches(2 * numPairs * k);
+	for (uint64_t p = 0; p < numPairs; ++p) {
+		uint32_t* a = &sketches[2 * p * k];
+		uint32_t* b = a + k;
+		clearSketch(a, k);
+		clearSketch(b, k);
+		for (uint64_t x = 0; x < 100; ++x)
+			addToSketch(a, k, 1000 * p + x);
+		for (uint64_t x = 11; x < 111; ++x)
+			addToSketch(b, k, 1000 * p + x);
+	}
+
+	size_t skipped = 0;
+	vector<uint64_t> pairs = findCandidatePairs(sketches.data(),
+			2 * numPairs, k, r, 1000, 4, setPairKey, skipped);
+	REQUIRE(skipped == 0);
+
+	// A pair is found with probability 1 - (1 - 0.8^4)^16 > 0.999.
+	size_t found = 0;
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		uint32_t x = pairs[i] >> 32, y = uint32_t(pairs[i]);
+		REQUIRE(x % 2 == 0);
+		REQUIRE(y == x + 1);
+		++found;
+	}
+	REQUIRE(found >= 0.99 * numPairs);
+
+	// The candidates do not depend on the number of threads.
+	REQUIRE(findCandidatePairs(sketches.data(), 2 * numPairs, k, r,
+				1000, 1, setPairKey, skipped) == pairs);
+}
+
+TEST_CASE("MinHash candidate pair bucket limit", "[MinHash]")
+{
+	// Ten equal sets, one empty set, and one other set
+	const unsigned k = 8, r = 2, n = 12;
+	vector<uint32_t> sketches(n * k);
+	for (unsigned i = 0; i < n; ++i) {
+		clearSketch(&sketches[i * k], k);
+		if (i < 10)
+			addToSketch(&sketches[i * k], k, 42);
+		else if (i == 11)
+			addToSketch(&sketches[i * k], k, 7);
+	}
+
+	size_t skipped = 0;
+	vector<uint64_t> pairs = findCandidatePairs(sketches.data(), n, k, r,
+			10, 2, setPairKey, skipped);
+	REQUIRE(pairs.size() == 45);
+	REQUIRE(skipped == 0);
+	REQUIRE(pairs.front() == setPairKey(0, 1));
+	REQUIRE(pairs.back() == setPairKey(8, 9));
+
+	pairs = findCandidatePairs(sketches.data(), n, k, r,
+			9, 2, setPairKey, skipped);
+	REQUIRE(pairs.empty());
+	REQUIRE(skipped == 10 * k / r);
+}
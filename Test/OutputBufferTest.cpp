@@ -0,0 +1,75 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/OutputBuffer.h"
+#include <limits>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+/** Return x formatted by an ostringstream. */
+template <typename T>
+static string expected(T x)
+{
+	ostringstream ss;
+	ss << x;
+	return ss.str();
+}
+
+TEST_CASE("format integers", "[OutputBuffer]")
+{
+	const int64_t values[] = { 0, 1, 9, 10, 99, 100, 101, 999, 1000,
+		12345, -1, -10, -99, -100, -12345,
+		numeric_limits<int32_t>::min(), numeric_limits<int32_t>::max(),
+		numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max() };
+	for (int64_t x : values) {
+		char buf[MAX_INTEGER_CHARS + 1];
+		REQUIRE(string(buf, formatInteger(buf, x)) == expected(x));
+	}
+	char buf[MAX_INTEGER_CHARS];
+	uint64_t max = numeric_limits<uint64_t>::max();
+	REQUIRE(string(buf, formatUnsigned(buf, max)) == expected(max));
+	for (uint64_t x = 1; x < max / 10; x = 10 * x + 7)
+		REQUIRE(string(buf, formatUnsigned(buf, x)) == expected(x));
+}
+
+TEST_CASE("buffered output", "[OutputBuffer]")
+{
+	ostringstream out;
+	{
+		OutputBuffer buf(&out);
+		buf << "contig" << '\t' << -5 << '\t' << 42u << '\t'
+			<< string("abc") << '\t' << StringRef("xyz", 2) << '\n';
+		REQUIRE(out.str().empty());
+	}
+	REQUIRE(out.str() == "contig\t-5\t42\tabc\txy\n");
+
+	// A buffer of a stream is written when it is full.
+	ostringstream big;
+	OutputBuffer buf(&big);
+	string line(1000, 'x');
+	for (size_t i = 0; i <= OutputBuffer::CAPACITY / line.size(); ++i)
+		buf << line;
+	REQUIRE(!big.str().empty());
+	buf.flush();
+	REQUIRE(big.str().size() % line.size() == 0);
+	REQUIRE(buf.str().empty());
+}
+
+TEST_CASE("write blocks in order", "[OutputBuffer]")
+{
+	const size_t n = 3 * OUTPUT_BLOCK_SIZE + 5;
+	ostringstream serial;
+	for (size_t i = 0; i < n; ++i)
+		serial << i << '\n';
+	for (unsigned threads = 1; threads <= 4; ++threads) {
+		ostringstream out;
+		writeBlocks(out, n, threads,
+			[](OutputBuffer& buf, size_t i) { buf << i << '\n'; });
+		REQUIRE(out.str() == serial.str());
+	}
+	ostringstream empty;
+	writeBlocks(empty, 0, 2, [](OutputBuffer&, size_t) {});
+	REQUIRE(empty.str().empty());
+}
@@ -2,6 +2,8 @@
 #include "ThirdParty/Catch/catch.hpp"
 
 #include "Common/SAM.h"
+#include <string>
+#include <vector>
 
 using namespace std;
 
@@ -13,3 +15,98 @@ TEST_CASE("parseBXTag", "[SAM]")
     REQUIRE(parseBXTag(tags1) == "CGTCAGGTCAGAGGTG-1");
     REQUIRE(parseBXTag(tags2).empty());
 }
+
+TEST_CASE("parseSAMRecord", "[SAM]")
+{
+    const string line("read1\t99\tctg1\t100\t60\t90M10S\t=\t300\t-250\tACGT\tFFFF\tNM:i:2\tBX:Z:ACGT-1");
+    SAMRecord rec;
+
+    REQUIRE(parseSAMRecord(line.data(), line.size(), rec));
+    REQUIRE(rec.qname == StringRef("read1"));
+    REQUIRE(rec.flag == 99);
+    REQUIRE(rec.rname == StringRef("ctg1"));
+    REQUIRE(rec.pos == 100);
+    REQUIRE(rec.mapq == 60);
+    REQUIRE(rec.cigar == StringRef("90M10S"));
+    REQUIRE(rec.pnext == 300);
+    REQUIRE(rec.tlen == -250);
+    REQUIRE(rec.seq.size == 4);
+    REQUIRE(rec.tags == StringRef("NM:i:2\tBX:Z:ACGT-1"));
+    REQUIRE(findSAMTag(rec.tags, "BX:Z:") == StringRef("ACGT-1"));
+    REQUIRE(parseSAMInt(findSAMTag(rec.tags, "NM:i:")) == 2);
+    REQUIRE(findSAMTag(rec.tags, "XT:i:").empty());
+
+    const string truncated("read1\t4\t*");
+    REQUIRE(!parseSAMRecord(truncated.data(), truncated.size(), rec));
+    REQUIRE(rec.rname == StringRef("*"));
+    REQUIRE(rec.seq.empty());
+    REQUIRE(rec.tags.empty());
+}
+
+TEST_CASE("cigarQueryLength", "[SAM]")
+{
+    REQUIRE(cigarQueryLength(StringRef("100M")) == 100);
+    REQUIRE(cigarQueryLength(StringRef("20S50M2I3D28M")) == 80);
+    REQUIRE(cigarQueryLength(StringRef("10=1X9=5H")) == 20);
+    REQUIRE(cigarQueryLength(StringRef("*")) == 0);
+}
+
+/** Require the bounds to split text at read boundaries. */
+static void checkSAMBounds(const string& text, size_t body,
+        const vector<const char*>& bounds)
+{
+    const char* end = text.data() + text.size();
+    REQUIRE(bounds.size() >= 2);
+    REQUIRE(bounds.front() == text.data() + body);
+    REQUIRE(bounds.back() == end);
+    for (size_t i = 1; i + 1 < bounds.size(); ++i) {
+        const char* p = bounds[i];
+        REQUIRE(p > bounds[i - 1]);
+        REQUIRE(p < end);
+        REQUIRE(p[-1] == '\n');
+        const char* prev = p - 1;
+        while (prev[-1] != '\n')
+            --prev;
+        REQUIRE(getReadName(getLine(prev, end)) != getReadName(getLine(p, end)));
+    }
+}
+
+TEST_CASE("splitSAMText", "[SAM]")
+{
+    const string header("@SQ\tSN:ctg1\tLN:1000\n");
+    const string text = header
+        + "r1\t99\tctg1\t1\t60\t4M\t=\t50\t53\tACGT\tFFFF\n"
+        + "r1\t147\tctg1\t50\t60\t4M\t=\t1\t-53\tACGT\tFFFF\n"
+        + "r2\t99\tctg1\t100\t60\t4M\t=\t150\t53\tACGT\tFFFF\n"
+        + "r2\t147\tctg1\t150\t60\t4M\t=\t100\t-53\tACGT\tFFFF\n"
+        + "r3\t99\tctg1\t200\t60\t4M\t=\t250\t53\tACGT\tFFFF\n"
+        + "r3\t2147\tctg1\t220\t60\t4M\t=\t250\t53\tACGT\tFFFF\n"
+        + "r3\t147\tctg1\t250\t60\t4M\t=\t200\t-53\tACGT\tFFFF\n";
+    const char* begin = text.data();
+    const char* body = begin + header.size();
+    const char* end = begin + text.size();
+
+    // Many split points fall inside the final read group, r3, whose
+    // boundary is the end of the text.
+    for (size_t numParts = 1; numParts <= 2 * text.size(); ++numParts) {
+        vector<const char*> bounds = splitSAMText(begin, body, end, numParts);
+        checkSAMBounds(text, header.size(), bounds);
+        REQUIRE(bounds.size() <= 4);
+    }
+
+    // A split inside the final read group makes no part.
+    const char* r3 = text.data() + text.find("r3\t");
+    vector<const char*> bounds = splitSAMText(begin, body, end, 1000);
+    REQUIRE(bounds.size() == 4);
+    REQUIRE(bounds[2] == r3);
+    REQUIRE(bounds[3] == end);
+
+    // A single read is one part.
+    const string one = header
+        + "r1\t99\tctg1\t1\t60\t4M\t=\t50\t53\tACGT\tFFFF\n"
+        + "r1\t147\tctg1\t50\t60\t4M\t=\t1\t-53\tACGT\tFFFF";
+    bounds = splitSAMText(one.data(), one.data() + header.size(),
+            one.data() + one.size(), 8);
+    REQUIRE(bounds.size() == 2);
+    checkSAMBounds(one, header.size(), bounds);
+}
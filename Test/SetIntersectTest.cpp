@@ -0,0 +1,61 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/SetIntersect.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <vector>
+
+using namespace std;
+
+/** Return a sorted set of n distinct random integers less than max. */
+static vector<uint32_t> randomSet(size_t n, uint32_t max)
+{
+	vector<uint32_t> v;
+	while (v.size() < n) {
+		for (size_t i = v.size(); i < n; ++i)
+			v.push_back(rand() % max);
+		sort(v.begin(), v.end());
+		v.erase(unique(v.begin(), v.end()), v.end());
+	}
+	return v;
+}
+
+static size_t expectedIntersection(
+		const vector<uint32_t>& a, const vector<uint32_t>& b)
+{
+	vector<uint32_t> c;
+	set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+			back_inserter(c));
+	return c.size();
+}
+
+TEST_CASE("countIntersection of small sets", "[SetIntersect]")
+{
+	const uint32_t a[] = { 1, 3, 5, 7, 9, 11, 13, 15, 17 };
+	const uint32_t b[] = { 2, 3, 4, 5, 6, 7, 8, 9, 10, 17 };
+	REQUIRE(countIntersection(a, 9, b, 10) == 5);
+	REQUIRE(countIntersection(b, 10, a, 9) == 5);
+	REQUIRE(countIntersection(a, 9, a, 9) == 9);
+	REQUIRE(countIntersection(a, 0, b, 10) == 0);
+	REQUIRE(countIntersection(a, 1, b, 10) == 0);
+	REQUIRE(countIntersection(a + 8, 1, b, 10) == 1);
+}
+
+TEST_CASE("countIntersection of random sets", "[SetIntersect]")
+{
+	srand(1);
+	const size_t sizes[] = { 1, 3, 4, 7, 8, 9, 16, 31, 100, 1000, 5000 };
+	for (size_t na : sizes) {
+		for (size_t nb : sizes) {
+			vector<uint32_t> a = randomSet(na, 3 * max(na, nb));
+			vector<uint32_t> b = randomSet(nb, 3 * max(na, nb));
+			size_t expected = expectedIntersection(a, b);
+			REQUIRE(countIntersection(a.data(), na, b.data(), nb) == expected);
+			REQUIRE(countIntersectionScalar(a.data(), na, b.data(), nb) == expected);
+			REQUIRE(countIntersectionSIMD(a.data(), na, b.data(), nb) == expected);
+			REQUIRE(countIntersectionGalloping(a.data(), na, b.data(), nb) == expected);
+		}
+	}
+}
@@ -28,3 +28,24 @@ TEST_CASE("quantile calculation", "[StatUtil]")
 	std::array<int, 5> data2 {{ 1, 2, 3, 4, 5 }};
 	REQUIRE(approxEqual(3.0, quantile(data2.begin(), data2.end(), 0.5), epsilon));
 }
+
+TEST_CASE("binomial critical values", "[StatUtil]")
+{
+	const float alphas[] = { 0.05, 0.01, 0.5, 1e-6, 0 };
+	for (float alpha : alphas) {
+		const unsigned maxN = 300;
+		BinomialCriticalValues table(0.5, alpha, maxN);
+
+		// the table agrees with the formula, within and beyond the bound
+		for (int n = 0; n <= int(maxN) + 20; ++n) {
+			for (int x = 0; x <= 2 * n + 20; ++x) {
+				bool expected = 1 - normalEstimation(x, 0.5, n) < alpha;
+				REQUIRE(table.significant(x, n) == expected);
+			}
+		}
+	}
+
+	BinomialCriticalValues table(0.5, 0.05);
+	REQUIRE(table.minSignificant(0) == 1);
+	REQUIRE(table.minSignificant(10) == 8);
+}